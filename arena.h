@@ -0,0 +1,153 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Bump allocator for scratch memory that dies together.
+ *
+ * alloc() moves a pointer through the current block and takes a new
+ * block only when it runs out; nothing is freed one by one.  reset()
+ * gives everything back at once and, if more than one block was needed,
+ * replaces them with a single block of their combined size, so a steady
+ * workload settles on one block and stops calling malloc.  Blocks are
+ * allocated on first use, by the thread that first allocates.
+ *
+ * Not thread safe: one arena per thread.
+ */
+class BumpArena {
+public:
+    explicit BumpArena(size_t block_bytes = 64 << 10)
+        : block_bytes(block_bytes), current(0), offset(0) {}
+    ~BumpArena() {
+        for (auto& b : blocks) {
+            free(b.data);
+        }
+    }
+    BumpArena(const BumpArena&) = delete;
+    BumpArena& operator=(const BumpArena&) = delete;
+
+    /* align must be a power of two */
+    void* alloc(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        if (current < blocks.size()) {
+            Block& b = blocks[current];
+            size_t start = aligned(b, offset, align);
+            if (start + bytes <= b.size) {
+                offset = start + bytes;
+                return b.data + start;
+            }
+        }
+        return alloc_slow(bytes, align);
+    }
+
+    /* Uninitialized room for n objects of T, which are never destroyed. */
+    template <class T>
+    T* alloc_array(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        return static_cast<T*>(alloc(n * sizeof(T), alignof(T)));
+    }
+
+    /* Position to rewind() to, dropping everything allocated after it. */
+    struct Mark {
+        size_t block;
+        size_t offset;
+    };
+    Mark mark() const { return Mark{current, offset}; }
+    void rewind(Mark m) {
+        current = m.block;
+        offset = m.offset;
+    }
+
+    void reset() {
+        if (current > 0) {
+            size_t total = 0;
+            for (auto& b : blocks) {
+                total += b.size;
+                free(b.data);
+            }
+            blocks.clear();
+            add_block(total);
+        }
+        current = 0;
+        offset = 0;
+    }
+
+    /* Bytes spanned since the last reset, alignment padding included. */
+    size_t used() const {
+        size_t n = offset;
+        for (size_t i = 0; i < current && i < blocks.size(); i++) {
+            n += blocks[i].size;
+        }
+        return n;
+    }
+    size_t capacity() const {
+        size_t n = 0;
+        for (auto& b : blocks) {
+            n += b.size;
+        }
+        return n;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    static size_t aligned(const Block& b, size_t off, size_t align) {
+        uintptr_t p = reinterpret_cast<uintptr_t>(b.data) + off;
+        return off + ((align - p % align) % align);
+    }
+
+    void add_block(size_t size) {
+        Block b{static_cast<char*>(malloc(size)), size};
+        if (!b.data) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(b);
+    }
+
+    /* Move on to the next block that fits, or append one. */
+    void* alloc_slow(size_t bytes, size_t align) {
+        if (blocks.empty()) {
+            add_block(std::max(block_bytes, bytes + align));
+            current = 0;
+        } else {
+            current++;
+            while (current < blocks.size() && aligned(blocks[current], 0, align) + bytes > blocks[current].size) {
+                current++;
+            }
+            if (current == blocks.size()) {
+                add_block(std::max(block_bytes, bytes + align));
+            }
+        }
+        offset = 0;
+        return alloc(bytes, align);
+    }
+
+    size_t block_bytes;
+    std::vector<Block> blocks;
+    size_t current;     /* block being bumped */
+    size_t offset;      /* next free byte in it */
+};
+
+/* Rewinds the arena when the scope ends, for per-item scratch in a loop. */
+class ArenaScope {
+public:
+    explicit ArenaScope(BumpArena& arena) : arena(arena), start(arena.mark()) {}
+    ~ArenaScope() { arena.rewind(start); }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    BumpArena& arena;
+    BumpArena::Mark start;
+};
+
+#endif
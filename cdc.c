@@ -1,11 +1,37 @@
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
 #include "cdc.h"
+#ifdef CDC_CSUM_CRC32C
+#include "crc32c.h"
+#endif
 
-#define BUF_MAX_SZ 1000
-#define BLOCK_MAX_SZ 1000
-#define BLOCK_WIN_SZ 1000
-#define BLOCK_MIN_SZ 100
+#define BUF_MAX_SZ 65536
+#define BLOCK_MAX_SZ 32768
+#define BLOCK_WIN_SZ 48
+#define BLOCK_MIN_SZ 512
+/* a window whose checksum is CHUNK_CDC_R modulo BLOCK_SZ ends a chunk,
+ * so chunks average about BLOCK_SZ bytes */
+#define BLOCK_SZ 4096
+#define CHUNK_CDC_R 13
 #define CHAR_OFFSET 8
 
+/* decimal string of x: at most 10 digits and the terminator */
+static void uint_2_str(uint32_t x, unsigned char *str)
+{
+	char digits[10];
+	int n = 0, i = 0;
+
+	do {
+		digits[n++] = '0' + x % 10;
+		x /= 10;
+	} while (x);
+	while (n)
+		str[i++] = digits[--n];
+	str[i] = '\0';
+}
+
 
 /*
  *   a simple 32 bit checksum that can be upadted from either end 
@@ -41,27 +67,108 @@ unsigned int adler32_rolling_checksum(unsigned int csum, int len, char c1, char
         return (s1 & 0xffff) + (s2 << 16);  
 }  
 
+uint32_t chunk_weak_checksum(char *block, uint32_t len)
+{
+#ifdef CDC_CSUM_CRC32C
+	return crc32c(0, block, len);
+#else
+	return adler32_checksum(block, len);
+#endif
+}
+
+int chunk_csum_verify(const chunk_block_entry *entry, char *block)
+{
+	uint32_t weak = chunk_weak_checksum(block, entry->len);
+#ifdef CDC_CSUM_CRC32C
+	return entry->csum == weak;
+#else
+	unsigned char csum[10 + 1] = {0};
+
+	uint_2_str(weak, csum);
+	return memcmp(entry->csum, csum, 10 + 1) == 0;
+#endif
+}
+
+/* fingerprint one chunk and append its block entry to the chunk file */
+static int chunk_emit(int fd_chunk, chunk_file_header *chunk_file_hdr, chunk_ctx *ctx,
+		char *block, uint32_t len, uint64_t offset)
+{
+	chunk_block_entry chunk_bentry;
+	uint32_t weak = chunk_weak_checksum(block, len);
+	off_t pos = 0;
+	ssize_t rwsize;
+	int dup = 0;
+
+	/* estimate mode: no md5 unless sampled, nothing written */
+	if (ctx && ctx->ds) {
+		dedup_sampler_add(ctx->ds, block, len, weak);
+		chunk_file_hdr->block_nr++;
+		return 0;
+	}
+	/* chunks arrive in file order, so this is the file digest for free */
+	if (ctx && ctx->file_stream)
+		md5_stream_update(ctx->file_stream, block, len);
+	memset(&chunk_bentry, 0, CHUNK_BLOCK_ENTRY_SZ);
+	chunk_bentry.len = len;
+	chunk_bentry.offset = offset;
+#ifdef CDC_CSUM_CRC32C
+	chunk_bentry.csum = weak;
+#else
+	uint_2_str(weak, chunk_bentry.csum);
+#endif
+	chunk_file_hdr->block_nr++;
+	if (ctx && ctx->wf) {
+		/* dedup mode: md5 is left to the weak filter, which patches it in */
+		pos = lseek(fd_chunk, 0, SEEK_CUR);
+		if (pos == -1)
+			return -1;
+		rwsize = write(fd_chunk, &chunk_bentry, CHUNK_BLOCK_ENTRY_SZ);
+		if (rwsize == -1 || rwsize != CHUNK_BLOCK_ENTRY_SZ)
+			return -1;
+		dup = weak_filter_check(ctx->wf, block, len, weak, fd_chunk,
+				pos + offsetof(chunk_block_entry, md5));
+		if (dup == -1)
+			return -1;
+	} else if (ctx && ctx->fs) {
+		/* batched mode: the stage hashes and writes the entry */
+		if (fp_stage_push(ctx->fs, fd_chunk, block, len, &chunk_bentry) == -1)
+			return -1;
+	} else {
+		md5(block, len, chunk_bentry.md5);
+		rwsize = write(fd_chunk, &chunk_bentry, CHUNK_BLOCK_ENTRY_SZ);
+		if (rwsize == -1 || rwsize != CHUNK_BLOCK_ENTRY_SZ)
+			return -1;
+	}
+	/* duplicates are already indexed, only new chunks need a sketch */
+	if (ctx && ctx->sk && !dup) {
+		int64_t base = sketch_index_add(ctx->sk, chunk_file_hdr->block_nr - 1, block, len);
+		if (base >= 0 && ctx->on_similar)
+			ctx->on_similar(ctx->similar_arg, chunk_file_hdr->block_nr - 1, (uint64_t)base);
+	}
+
+	return 0;
+}
+
 /* content-defined chunking */
 /*fd_src为分块的源文件*/
 /*fd_chunk为分块后的文件*/
 /*分块文件头chunk file header*/
-static int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_file_hdr)
+static int chunk_cdc_run(int fd_src, int fd_chunk, chunk_file_header *chunk_file_hdr, chunk_ctx *ctx)
 {
 	char buf[BUF_MAX_SZ] = {0};  //缓冲区最大值
 	char block_buf[BLOCK_MAX_SZ] = {0}; // 块的最大值
 	char win_buf[BLOCK_WIN_SZ + 1] = {0}; //块的窗口大小
-	unsigned char md5_checksum[16 + 1] = {0};
-	unsigned char csum[10 + 1] = {0};
 	unsigned int bpos = 0;
 	unsigned int rwsize = 0;
+	ssize_t n;
 	unsigned int exp_rwsize = BUF_MAX_SZ;
 	unsigned int head, tail;
 	unsigned int block_sz = 0, old_block_sz = 0;
 	unsigned int hkey = 0;
-	chunk_block_entry chunk_bentry; //分块实体
 	uint64_t offset = 0;
 
-	while(rwsize = read(fd_src, buf + bpos, exp_rwsize)) {
+	while ((n = read(fd_src, buf + bpos, exp_rwsize)) > 0) {
+		rwsize = n;
 		/* last chunk */
 		if ((rwsize + bpos + block_sz) < BLOCK_MIN_SZ)
 			break;
@@ -80,7 +187,9 @@ static int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_fil
 		while ((head + BLOCK_WIN_SZ) <= tail) {
 			memcpy(win_buf, buf + head, BLOCK_WIN_SZ);
 			hkey = (block_sz == (BLOCK_MIN_SZ - BLOCK_WIN_SZ)) ? adler32_checksum(win_buf, BLOCK_WIN_SZ) :
-				adler32_rolling_checksum(hkey, BLOCK_WIN_SZ, buf[head-1], buf[head+BLOCK_WIN_SZ-1]);
+				/* the byte leaving the window is the last one added to the
+				 * block; buf[head-1] is gone when head is 0 after a refill */
+				adler32_rolling_checksum(hkey, BLOCK_WIN_SZ, block_buf[block_sz-1], buf[head+BLOCK_WIN_SZ-1]);
 
 			/* get a normal chunk, write block info to chunk file */
 			if ((hkey % BLOCK_SZ) == CHUNK_CDC_R) {
@@ -88,15 +197,7 @@ static int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_fil
 				head += BLOCK_WIN_SZ;
 				block_sz += BLOCK_WIN_SZ;
 				if (block_sz >= BLOCK_MIN_SZ) {
-					md5(block_buf, block_sz, md5_checksum);
-					uint_2_str(adler32_checksum(block_buf, block_sz), csum);
-					chunk_file_hdr->block_nr++;
-					chunk_bentry.len = block_sz;
-					chunk_bentry.offset = offset;
-					memcpy(chunk_bentry.md5, md5_checksum, 16 + 1);
-					memcpy(chunk_bentry.csum, csum, 10 + 1);
-					rwsize = write(fd_chunk, &chunk_bentry, CHUNK_BLOCK_ENTRY_SZ);
-					if (rwsize == -1 || rwsize != CHUNK_BLOCK_ENTRY_SZ)
+					if (chunk_emit(fd_chunk, chunk_file_hdr, ctx, block_buf, block_sz, offset) == -1)
 						return -1;
 					offset += block_sz;
 					block_sz = 0;
@@ -105,15 +206,7 @@ static int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_fil
 				block_buf[block_sz++] = buf[head++];
 				/* get an abnormal chunk, write block info to chunk file */
 				if (block_sz >= BLOCK_MAX_SZ) {
-					md5(block_buf, block_sz, md5_checksum);
-					uint_2_str(adler32_checksum(block_buf, block_sz), csum);
-					chunk_file_hdr->block_nr++;
-					chunk_bentry.len = block_sz;
-					chunk_bentry.offset = offset;
-					memcpy(chunk_bentry.md5, md5_checksum, 16+1);
-					memcpy(chunk_bentry.csum, csum, 10 + 1);
-					rwsize = write(fd_chunk, &chunk_bentry, CHUNK_BLOCK_ENTRY_SZ);
-					if (rwsize == -1 || rwsize != CHUNK_BLOCK_ENTRY_SZ)
+					if (chunk_emit(fd_chunk, chunk_file_hdr, ctx, block_buf, block_sz, offset) == -1)
 						return -1;
 					offset += block_sz;
 					block_sz = 0;
@@ -136,25 +229,40 @@ static int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_fil
 		memmove(buf, buf + head, bpos);
 	}
 
-	if (rwsize == -1)
+	if (n == -1)
 		return -1;
+	if (n == 0)
+		rwsize = 0;
 	/* process last block */
 	uint32_t last_block_sz = ((rwsize + bpos + block_sz) >= 0) ? rwsize + bpos + block_sz : 0;
-	char last_block_buf[BLOCK_MAX_SZ] = {0};
+	/* up to a full block plus an unfinished window */
+	char last_block_buf[BLOCK_MAX_SZ + BLOCK_WIN_SZ] = {0};
 	if (last_block_sz > 0) {
 		memcpy(last_block_buf, block_buf, block_sz);
 		memcpy(last_block_buf + block_sz, buf, rwsize + bpos);
-		md5(last_block_buf, last_block_sz, md5_checksum);
-		uint_2_str(adler32_checksum(last_block_buf, last_block_sz), csum);
-		chunk_file_hdr->block_nr++;
-		chunk_bentry.len = last_block_sz;
-		chunk_bentry.offset = offset;
-		memcpy(chunk_bentry.md5, md5_checksum, 16+1);
-		memcpy(chunk_bentry.csum, csum, 10 + 1);
-		rwsize = write(fd_chunk, &chunk_bentry, CHUNK_BLOCK_ENTRY_SZ);
-		if (rwsize == -1 || rwsize != CHUNK_BLOCK_ENTRY_SZ)
+		if (chunk_emit(fd_chunk, chunk_file_hdr, ctx, last_block_buf, last_block_sz, offset) == -1)
 			return -1;
 	}
 
 	return 0;
+}
+
+int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_file_hdr, chunk_ctx *ctx)
+{
+	int ret;
+
+	if (ctx && ctx->file_digest)
+		ctx->file_stream = md5_stream_create();
+	ret = chunk_cdc_run(fd_src, fd_chunk, chunk_file_hdr, ctx);
+	if (ctx && ctx->file_stream) {
+		md5_stream_final(ctx->file_stream, ctx->file_md5);
+		ctx->file_stream = NULL;
+	}
+	/* background writes into fd_chunk must be done before we return */
+	if (ctx && ctx->fs && !ctx->wf && fp_stage_flush(ctx->fs) == -1)
+		ret = -1;
+	if (ctx && ctx->wf && weak_filter_drain(ctx->wf) == -1)
+		ret = -1;
+
+	return ret;
 }
\ No newline at end of file
@@ -1,5 +1,13 @@
+#ifndef CDC_H
+#define CDC_H
+
 #include <stdio.h>
 #include <inttypes.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 
 /* define chunk file header and block entry */  
@@ -12,7 +20,11 @@ typedef struct _chunk_block_entry {
         uint64_t offset;  
         uint32_t len;  
         uint8_t  md5[16 + 1];  
+#ifdef CDC_CSUM_CRC32C
+        uint32_t csum;          /* raw crc32c */
+#else
         uint8_t  csum[10 + 1];  
+#endif
 } chunk_block_entry;  
 #define CHUNK_BLOCK_ENTRY_SZ    (sizeof(chunk_block_entry))  
 
@@ -31,4 +43,96 @@ typedef struct _delta_block_entry {
 #define DELTA_BLOCK_ENTRY_SZ    (sizeof(delta_block_entry))  
 
 
-static int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_file_hdr);
\ No newline at end of file
+/* 
+ * weak per-chunk checksum: adler32 as an 11 byte decimal string by
+ * default, raw crc32c (crc32c.c) when built with CDC_CSUM_CRC32C
+ */
+uint32_t chunk_weak_checksum(char *block, uint32_t len);
+/* 1 if block still matches the checksum recorded in entry, e.g. on restore */
+int chunk_csum_verify(const chunk_block_entry *entry, char *block);
+
+/* strong digest, implemented in md5.cpp */
+void md5(const char *input, size_t length, unsigned char digest[17]);
+typedef struct _md5_stream md5_stream;
+md5_stream *md5_stream_create(void);
+void md5_stream_update(md5_stream *stream, const char *input, size_t length);
+void md5_stream_final(md5_stream *stream, unsigned char digest[17]);
+
+/* 
+ * weak checksum + length lookup in front of the strong digest, implemented
+ * in prefilter.cpp. check returns 1 for a duplicate, 0 for a new chunk and
+ * -1 on error; the md5 is written to fd_chunk at md5_pos, for new chunks
+ * only once drain returns.
+ */
+typedef struct _weak_filter weak_filter;
+typedef struct _weak_filter_stats {
+        uint64_t chunks;        /* chunks checked */
+        uint64_t weak_hits;     /* weak key seen before, md5 computed inline */
+        uint64_t dup_chunks;    /* weak hits whose md5 also matched */
+        uint64_t dup_bytes;
+} weak_filter_stats_t;
+weak_filter *weak_filter_create(size_t workers);
+int weak_filter_check(weak_filter *wf, const char *block, uint32_t len,
+                      uint32_t weak, int fd_chunk, off_t md5_pos);
+int weak_filter_drain(weak_filter *wf);
+/* counters since create; weak_hits - dup_chunks are weak false positives */
+void weak_filter_stats(const weak_filter *wf, weak_filter_stats_t *stats);
+void weak_filter_destroy(weak_filter *wf);
+
+/* 
+ * similarity sketches for delta-compression candidates, implemented in
+ * sketch.cpp. add indexes a chunk under id and returns the id of the most
+ * similar chunk indexed before it, or -1. Chunks too short to sample are
+ * neither indexed nor matched.
+ */
+typedef struct _sketch_index sketch_index;
+sketch_index *sketch_index_create(void);
+int64_t sketch_index_add(sketch_index *sk, uint64_t id, const char *block, uint32_t len);
+void sketch_index_destroy(sketch_index *sk);
+
+/* 
+ * dedup ratio estimation from a content-defined sample of chunks,
+ * implemented in sample.cpp; 1 / 2^bits of the chunks are fingerprinted.
+ * create returns NULL unless 0 <= bits <= 32; add may be called from
+ * several threads at once.
+ */
+typedef struct _dedup_sampler dedup_sampler;
+dedup_sampler *dedup_sampler_create(int bits);
+void dedup_sampler_add(dedup_sampler *ds, const char *block, uint32_t len, uint32_t weak);
+void dedup_sampler_destroy(dedup_sampler *ds);
+
+/* 
+ * batched fingerprint stage, implemented in fpstage.cpp. push copies the
+ * chunk into the current batch; batches are hashed on the stage's own
+ * threads and their entries written to fd_chunk in order. flush writes
+ * out everything pushed so far. Both return -1 on error.
+ */
+typedef struct _fp_stage fp_stage;
+fp_stage *fp_stage_create(size_t workers, size_t batch_bytes, size_t max_inflight);
+int fp_stage_push(fp_stage *fs, int fd_chunk, const char *block, uint32_t len,
+                  const chunk_block_entry *entry);
+int fp_stage_flush(fp_stage *fs);
+void fp_stage_destroy(fp_stage *fs);
+
+/* optional collaborators of the chunker, NULL members are skipped */
+typedef struct _chunk_ctx {
+        weak_filter *wf;        /* dedup mode: weak lookup before md5 */
+        sketch_index *sk;       /* sketch every stored (non-duplicate) chunk */
+        /* delta candidate found by sk: entry id resembles entry base,
+         * both counted in block entries from the start of the chunk file */
+        void (*on_similar)(void *arg, uint64_t id, uint64_t base);
+        void *similar_arg;
+        dedup_sampler *ds;      /* estimate only: sample, write no entries */
+        fp_stage *fs;           /* hash off the chunking thread, in batches */
+        int file_digest;        /* also digest the whole file in the same pass */
+        uint8_t file_md5[16 + 1];       /* out: whole-file md5 if file_digest */
+        md5_stream *file_stream;        /* internal */
+} chunk_ctx;
+
+int file_chunk_cdc(int fd_src, int fd_chunk, chunk_file_header *chunk_file_hdr, chunk_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Chunker round-trip checks: chunk a generated file in every mode, read
+ * the block entries back and check them against the source bytes.
+ *
+ *   gcc -O2 -c cdc.c
+ *   g++ -std=c++17 -O2 -pthread cdc_test.cpp cdc.o md5.cpp prefilter.cpp \
+ *       sketch.cpp sample.cpp fpstage.cpp -o cdc_test
+ *   ./cdc_test
+ *
+ * Exits non-zero on the first failed check.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cdc.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+static std::string temp_path(const char* tag) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/cdc_test_%s_%d", tag, (int)getpid());
+    return path;
+}
+
+/* Random data with repeated and near-repeated regions, so the dedup and
+ * sketch paths have something to find. */
+static std::vector<char> make_input(size_t bytes) {
+    std::vector<char> data(bytes);
+    srand(1);
+    for (auto& c : data) {
+        c = static_cast<char>(rand() >> 7);
+    }
+    size_t block = bytes / 8;
+    if (block == 0) {
+        return data;
+    }
+    memcpy(&data[4 * block], &data[block], block);
+    memcpy(&data[6 * block], &data[2 * block], block);
+    for (size_t i = 6 * block; i < 7 * block; i += 1000) {
+        data[i] ^= 1;
+    }
+    return data;
+}
+
+struct Chunked {
+    chunk_file_header hdr;
+    std::vector<chunk_block_entry> entries;
+    uint8_t file_md5[17];
+};
+
+/* Chunk src in the mode ctx selects and read the entries back. */
+static Chunked chunk(const std::string& src, chunk_ctx* ctx) {
+    std::string out = temp_path("entries");
+    int fd_src = open(src.c_str(), O_RDONLY);
+    int fd_chunk = open(out.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd_src >= 0 && fd_chunk >= 0);
+
+    Chunked c;
+    c.hdr = {0, 0};
+    ctx->file_digest = 1;
+    CHECK(file_chunk_cdc(fd_src, fd_chunk, &c.hdr, ctx) == 0);
+    memcpy(c.file_md5, ctx->file_md5, sizeof(c.file_md5));
+
+    c.entries.resize(c.hdr.block_nr);
+    ssize_t bytes = c.entries.size() * CHUNK_BLOCK_ENTRY_SZ;
+    CHECK(pread(fd_chunk, c.entries.data(), bytes, 0) == bytes);
+    CHECK(lseek(fd_chunk, 0, SEEK_END) == bytes);
+    close(fd_src);
+    close(fd_chunk);
+    unlink(out.c_str());
+    return c;
+}
+
+/* Entries tile the input, and md5 and checksum match the bytes. */
+static void verify(const Chunked& c, std::vector<char>& data) {
+    uint64_t offset = 0;
+    for (auto& e : c.entries) {
+        CHECK(e.offset == offset);
+        CHECK(e.len > 0 && offset + e.len <= data.size());
+        char* block = data.data() + offset;
+        unsigned char digest[17];
+        md5(block, e.len, digest);
+        CHECK(memcmp(digest, e.md5, 16) == 0);
+        CHECK(chunk_csum_verify(&e, block) == 1);
+        block[e.len / 2] ^= 0x40;
+        CHECK(chunk_csum_verify(&e, block) == 0);
+        block[e.len / 2] ^= 0x40;
+        offset += e.len;
+    }
+    CHECK(offset == data.size());
+
+    unsigned char whole[17];
+    md5(data.data(), data.size(), whole);
+    CHECK(memcmp(whole, c.file_md5, 16) == 0);
+}
+
+struct Similar {
+    uint64_t id;
+    uint64_t base;
+};
+
+static void on_similar(void* arg, uint64_t id, uint64_t base) {
+    static_cast<std::vector<Similar>*>(arg)->push_back(Similar{id, base});
+}
+
+/* Candidates name earlier, non-duplicate entries; the near copy of the
+ * third eighth finds its bases there. */
+static void verify_similar(const std::vector<Similar>& similar, const Chunked& c, size_t bytes) {
+    size_t block = bytes / 8, near = 0;
+    for (auto& s : similar) {
+        CHECK(s.base < s.id && s.id < c.entries.size());
+        uint64_t at = c.entries[s.id].offset, from = c.entries[s.base].offset;
+        if (at >= 6 * block && at < 7 * block) {
+            near += from + 4096 >= 2 * block && from < 3 * block;
+        }
+    }
+    CHECK(bytes < (1 << 20) || near > 0);
+}
+
+static bool same_entries(const Chunked& a, const Chunked& b) {
+    return a.entries.size() == b.entries.size() &&
+           (a.entries.empty() || memcmp(a.entries.data(), b.entries.data(),
+                                        a.entries.size() * CHUNK_BLOCK_ENTRY_SZ) == 0);
+}
+
+int main() {
+    std::string src = temp_path("src");
+    for (size_t bytes : {size_t(0), size_t(100), size_t(5000), size_t(3) << 20}) {
+        std::vector<char> data = make_input(bytes);
+        FILE* f = fopen(src.c_str(), "wb");
+        CHECK(f && (data.empty() || fwrite(data.data(), 1, data.size(), f) == data.size()));
+        fclose(f);
+
+        chunk_ctx plain_ctx = {};
+        Chunked plain = chunk(src, &plain_ctx);
+        verify(plain, data);
+
+        chunk_ctx dedup_ctx = {};
+        dedup_ctx.wf = weak_filter_create(2);
+        Chunked dedup = chunk(src, &dedup_ctx);
+        weak_filter_stats_t stats;
+        weak_filter_stats(dedup_ctx.wf, &stats);
+        weak_filter_destroy(dedup_ctx.wf);
+        CHECK(stats.chunks == plain.entries.size());
+        CHECK(stats.dup_chunks <= stats.weak_hits && stats.weak_hits <= stats.chunks);
+        /* the copied eighth of the input comes back as duplicates */
+        CHECK(bytes < (1 << 20) || stats.dup_bytes >= bytes / 16);
+        CHECK(same_entries(plain, dedup));
+
+        std::vector<Similar> similar;
+        chunk_ctx sketch_ctx = {};
+        sketch_ctx.wf = weak_filter_create(2);
+        sketch_ctx.sk = sketch_index_create();
+        sketch_ctx.on_similar = on_similar;
+        sketch_ctx.similar_arg = &similar;
+        Chunked sketched = chunk(src, &sketch_ctx);
+        weak_filter_destroy(sketch_ctx.wf);
+        sketch_index_destroy(sketch_ctx.sk);
+        CHECK(same_entries(plain, sketched));
+        verify_similar(similar, plain, bytes);
+
+        chunk_ctx batch_ctx = {};
+        batch_ctx.fs = fp_stage_create(3, 64 << 10, 4);
+        Chunked batch = chunk(src, &batch_ctx);
+        fp_stage_destroy(batch_ctx.fs);
+        CHECK(same_entries(plain, batch));
+
+        printf("%zu bytes: %zu chunks, %llu weak hits, %llu duplicate bytes, %zu similar ok\n",
+               bytes, plain.entries.size(), (unsigned long long)stats.weak_hits,
+               (unsigned long long)stats.dup_bytes, similar.size());
+    }
+    unlink(src.c_str());
+    return 0;
+}
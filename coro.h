@@ -0,0 +1,372 @@
+#ifndef CORO_H
+#define CORO_H
+
+/*
+ * C++20 coroutines on ThreadPool.
+ *
+ *     CoTask<void> ingest(ThreadPool& pool, CoIo& io, int fd) {
+ *         std::vector<char> buf(1 << 20);
+ *         ssize_t n = co_await io.read(fd, buf.data(), buf.size(), 0);
+ *         auto fp = co_await run_on(pool, [&]{ return hash(buf.data(), n); });
+ *         co_await index_lookup(fp);
+ *     }
+ *     sync_wait(ingest(pool, io, fd));
+ *
+ * A CoTask starts when awaited and resumes its awaiter when it finishes.
+ * schedule_on() moves a coroutine onto a pool worker, run_on() runs a
+ * callable as a pool task and resumes with its result, and CoIo performs
+ * reads and writes on its own threads and resumes the coroutine on the
+ * pool, so no worker ever blocks in read().  Resumption goes through
+ * ThreadPool::post, so it allocates nothing beyond the coroutine frames.
+ *
+ * Without compiler coroutine support this header is empty.
+ */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "threadpool.h"
+
+/* A value or an exception, filled in by whoever ran the work. */
+template <class R>
+struct CoResult {
+    std::optional<R> value;
+    std::exception_ptr error;
+
+    template <class F>
+    void run(F& f) {
+        try {
+            value.emplace(f());
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    R take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct CoResult<void> {
+    std::exception_ptr error;
+
+    template <class F>
+    void run(F& f) {
+        try {
+            f();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+template <class T = void>
+class CoTask;
+
+template <class T>
+struct CoPromiseBase {
+    /* who to resume when we finish; nobody until awaited */
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    CoResult<T> result;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { result.error = std::current_exception(); }
+};
+
+template <class T>
+struct CoPromise : CoPromiseBase<T> {
+    CoTask<T> get_return_object();
+    void return_value(T v) { this->result.value.emplace(std::move(v)); }
+};
+
+template <>
+struct CoPromise<void> : CoPromiseBase<void> {
+    CoTask<void> get_return_object();
+    void return_void() {}
+};
+
+/* Lazily started coroutine producing T; owns its frame. */
+template <class T>
+class CoTask {
+public:
+    typedef CoPromise<T> promise_type;
+
+    explicit CoTask(std::coroutine_handle<promise_type> h) : h(h) {}
+    CoTask(CoTask&& o) noexcept : h(std::exchange(o.h, nullptr)) {}
+    CoTask& operator=(CoTask&& o) noexcept {
+        if (this != &o) {
+            if (h) {
+                h.destroy();
+            }
+            h = std::exchange(o.h, nullptr);
+        }
+        return *this;
+    }
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+    ~CoTask() {
+        if (h) {
+            h.destroy();
+        }
+    }
+
+    /* co_await starts the task by symmetric transfer */
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        h.promise().continuation = awaiter;
+        return h;
+    }
+    T await_resume() { return h.promise().result.take(); }
+
+private:
+    std::coroutine_handle<promise_type> h;
+};
+
+template <class T>
+CoTask<T> CoPromise<T>::get_return_object() {
+    return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object() {
+    return CoTask<void>(std::coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+/* Eagerly started coroutine that frees itself at the end; the driver for
+ * sync_wait() and spawn(). */
+struct CoDetached {
+    struct promise_type {
+        CoDetached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+/* co_await schedule_on(pool) continues on one of its workers. */
+struct CoSchedule {
+    ThreadPool& pool;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        pool.post([h]{ h.resume(); });
+    }
+    void await_resume() const noexcept {}
+};
+
+inline CoSchedule schedule_on(ThreadPool& pool) {
+    return CoSchedule{pool};
+}
+
+/* co_await run_on(pool, f) runs f as a pool task and continues on that
+ * worker with its result. */
+template <class F>
+struct CoPoolCall {
+    typedef std::invoke_result_t<F&> R;
+
+    ThreadPool& pool;
+    F fn;
+    CoResult<R> result;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        pool.post([this, h]{
+            result.run(fn);
+            h.resume();
+        });
+    }
+    R await_resume() { return result.take(); }
+};
+
+template <class F>
+CoPoolCall<std::decay_t<F>> run_on(ThreadPool& pool, F&& f) {
+    return CoPoolCall<std::decay_t<F>>{pool, std::forward<F>(f), {}};
+}
+
+/* Block the calling thread until task finishes; returns or rethrows its
+ * result.  Do not call from a pool worker the task needs. */
+template <class T>
+T sync_wait(CoTask<T> task) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    CoResult<T> result;
+
+    [](CoTask<T>& t, CoResult<T>& r, std::mutex& m, std::condition_variable& c,
+       bool& d) -> CoDetached {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await t;
+            } else {
+                r.value.emplace(co_await t);
+            }
+        } catch (...) {
+            r.error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(m);
+        d = true;
+        c.notify_one();
+    }(task, result, mutex, cv, done);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]{ return done; });
+    return result.take();
+}
+
+/* Run task on the pool without waiting for it.  It must not throw. */
+inline void spawn(ThreadPool& pool, CoTask<void> task) {
+    [](ThreadPool& p, CoTask<void> t) -> CoDetached {
+        co_await schedule_on(p);
+        co_await t;
+    }(pool, std::move(task));
+}
+
+/*
+ * Blocking reads and writes on dedicated I/O threads.  The awaiting
+ * coroutine is parked meanwhile and resumed on the pool, so workers only
+ * ever run CPU work.  Results are the byte count or -errno.  Once the pool
+ * is shutting down completions resume on the I/O thread instead, and once
+ * this CoIo is being destroyed new operations fail with -ECANCELED.
+ */
+class CoIo {
+public:
+    explicit CoIo(ThreadPool& pool, size_t threads = 1) : pool(pool), stop(false), head(nullptr), tail(nullptr) {
+        for (size_t i = 0; i < (threads ? threads : 1); i++) {
+            io_threads.emplace_back([this]{ loop(); });
+        }
+    }
+
+    ~CoIo() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto& t : io_threads) {
+            t.join();
+        }
+    }
+
+    CoIo(const CoIo&) = delete;
+    CoIo& operator=(const CoIo&) = delete;
+
+    struct Op {
+        CoIo* io;
+        bool write;
+        int fd;
+        void* buf;
+        size_t len;
+        off_t offset;
+        ssize_t result;
+        std::coroutine_handle<> h;
+        Op* next;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> awaiter) {
+            h = awaiter;
+            return io->submit(this);
+        }
+        ssize_t await_resume() const noexcept { return result; }
+    };
+
+    /* co_await io.read(fd, buf, len, offset) */
+    Op read(int fd, void* buf, size_t len, off_t offset) {
+        return Op{this, false, fd, buf, len, offset, 0, nullptr, nullptr};
+    }
+
+    /* co_await io.write(fd, buf, len, offset) */
+    Op write(int fd, const void* buf, size_t len, off_t offset) {
+        return Op{this, true, fd, const_cast<void*>(buf), len, offset, 0, nullptr, nullptr};
+    }
+
+private:
+    /* false, with the op failed, if no I/O thread would ever pick it up */
+    bool submit(Op* op) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stop) {
+                op->result = -ECANCELED;
+                return false;
+            }
+            if (tail) {
+                tail->next = op;
+            } else {
+                head = op;
+            }
+            tail = op;
+        }
+        cv.notify_one();
+        return true;
+    }
+
+    void loop() {
+        for (;;) {
+            Op* op;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]{ return stop || head; });
+                if (!head) {
+                    return;
+                }
+                op = head;
+                head = op->next;
+                if (!head) {
+                    tail = nullptr;
+                }
+            }
+            ssize_t n = op->write ? pwrite(op->fd, op->buf, op->len, op->offset)
+                                  : pread(op->fd, op->buf, op->len, op->offset);
+            op->result = n < 0 ? -errno : n;
+            std::coroutine_handle<> h = op->h;
+            try {
+                pool.post([h]{ h.resume(); });
+            } catch (...) {
+                /* the pool is stopping; finish the coroutine here */
+                h.resume();
+            }
+        }
+    }
+
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop;
+    Op* head;
+    Op* tail;
+    std::vector<std::thread> io_threads;
+};
+
+#endif
+
+#endif
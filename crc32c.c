@@ -0,0 +1,103 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78  /* reflected 0x1edc6f41 */
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_hw;
+
+static void crc32c_init(void)
+{
+	uint32_t i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+#ifdef CRC32C_X86
+	crc32c_hw = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+/* 8 bytes per step through 8 tables, little-endian word loads */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t word;
+
+	pthread_once(&crc32c_once, crc32c_init);
+	crc = ~crc;
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&word, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		word = __builtin_bswap64(word);
+#endif
+		word ^= crc;
+		crc = crc32c_table[7][word & 0xff] ^
+		      crc32c_table[6][(word >> 8) & 0xff] ^
+		      crc32c_table[5][(word >> 16) & 0xff] ^
+		      crc32c_table[4][(word >> 24) & 0xff] ^
+		      crc32c_table[3][(word >> 32) & 0xff] ^
+		      crc32c_table[2][(word >> 40) & 0xff] ^
+		      crc32c_table[1][(word >> 48) & 0xff] ^
+		      crc32c_table[0][word >> 56];
+	}
+	for (; len; len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw_run(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t c = ~crc, word;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		c = _mm_crc32_u8((uint32_t)c, *p++);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&word, p, 8);
+		c = _mm_crc32_u64(c, word);
+	}
+	for (; len; len--)
+		c = _mm_crc32_u8((uint32_t)c, *p++);
+
+	return ~(uint32_t)c;
+}
+#endif
+
+int crc32c_hw_available(void)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_hw;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+#ifdef CRC32C_X86
+	if (crc32c_hw_available())
+		return crc32c_hw_run(crc, buf, len);
+#endif
+	return crc32c_sw(crc, buf, len);
+}
@@ -0,0 +1,28 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC-32C (Castagnoli), using the SSE4.2 crc32 instruction when the cpu
+ * has it and slice-by-8 tables otherwise. Pass 0 as crc to start, or a
+ * previous result to continue over more data.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* portable slice-by-8 path, exposed for testing and benchmarks */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+
+/* nonzero if crc32c() uses the crc32 instruction */
+int crc32c_hw_available(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+/*
+ * Fixed-width chunk fingerprint (MD5 = 16 bytes, SHA-256 = 32 bytes).
+ *
+ * The digest is held as 64-bit words so equality and ordering are a
+ * handful of word compares, and hashing just takes the first word: the
+ * digest bits are already uniformly distributed.  Ordering is by word
+ * value, not by byte string, which is all sorted indexes need.
+ */
+template <size_t Bytes>
+struct Fingerprint {
+    static_assert(Bytes % 8 == 0, "fingerprint width must be whole words");
+    static constexpr size_t size = Bytes;
+    static constexpr size_t words = Bytes / 8;
+
+    uint64_t w[words];
+
+    static Fingerprint from_bytes(const void* digest) {
+        Fingerprint f;
+        memcpy(f.w, digest, Bytes);
+        return f;
+    }
+
+    void to_bytes(void* out) const {
+        memcpy(out, w, Bytes);
+    }
+
+    const uint8_t* data() const {
+        return reinterpret_cast<const uint8_t*>(w);
+    }
+
+    /* Lowercase hex, for logs and text formats only. */
+    std::string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string s(Bytes * 2, '0');
+        const uint8_t* p = data();
+        for (size_t i = 0; i < Bytes; i++) {
+            s[2 * i] = digits[p[i] >> 4];
+            s[2 * i + 1] = digits[p[i] & 0xf];
+        }
+        return s;
+    }
+
+    friend constexpr bool operator==(const Fingerprint& a, const Fingerprint& b) {
+        uint64_t diff = 0;
+        for (size_t i = 0; i < words; i++) {
+            diff |= a.w[i] ^ b.w[i];
+        }
+        return diff == 0;
+    }
+
+    friend constexpr bool operator!=(const Fingerprint& a, const Fingerprint& b) {
+        return !(a == b);
+    }
+
+    friend constexpr bool operator<(const Fingerprint& a, const Fingerprint& b) {
+        for (size_t i = 0; i < words; i++) {
+            if (a.w[i] != b.w[i]) {
+                return a.w[i] < b.w[i];
+            }
+        }
+        return false;
+    }
+
+    friend constexpr bool operator>(const Fingerprint& a, const Fingerprint& b) { return b < a; }
+    friend constexpr bool operator<=(const Fingerprint& a, const Fingerprint& b) { return !(b < a); }
+    friend constexpr bool operator>=(const Fingerprint& a, const Fingerprint& b) { return !(a < b); }
+};
+
+typedef Fingerprint<16> Fingerprint128;
+typedef Fingerprint<32> Fingerprint256;
+
+static_assert(std::is_trivially_copyable<Fingerprint128>::value, "Fingerprint128 must be trivially copyable");
+static_assert(sizeof(Fingerprint128) == 16, "Fingerprint128 must not be padded");
+static_assert(sizeof(Fingerprint256) == 32, "Fingerprint256 must not be padded");
+
+namespace std {
+    template <size_t Bytes>
+    struct hash<Fingerprint<Bytes>> {
+        size_t operator()(const Fingerprint<Bytes>& f) const noexcept {
+            return static_cast<size_t>(f.w[0]);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Fingerprint kernel benchmark: every hashing kernel over chunk sizes
+ * from 512 B to 1 MiB, on one thread and on a ThreadPool, as CSV.
+ *
+ *   g++ -std=c++17 -O2 -pthread fingerprint_bench.cpp md5.cpp sketch.cpp crc32c.c \
+ *       -o fingerprint_bench
+ *   ./fingerprint_bench [MiB per run] [threads] > bench.csv
+ *
+ * cycles_per_byte is per core: wall-clock TSC ticks times threads over
+ * bytes hashed.  CMD5 is not listed because cmd5.cpp is unfinished.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "crc32c.h"
+#include "md5.h"
+#include "sketch.h"
+#include "threadpool.h"
+
+/* largest chunk size benchmarked */
+static const size_t MAX_CHUNK = 1 << 20;
+
+struct Kernel {
+    const char* name;
+    std::function<uint64_t(const char*, size_t)> run;
+};
+
+static uint64_t ticks() {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Hash every chunk of [begin, end), returning something to keep. */
+static uint64_t hash_range(const Kernel& k, const std::vector<char>& data,
+                           size_t chunk, size_t begin, size_t end) {
+    uint64_t sink = 0;
+    for (size_t off = begin; off + chunk <= end; off += chunk) {
+        sink += k.run(&data[off], chunk);
+    }
+    return sink;
+}
+
+static void run(const Kernel& k, const std::vector<char>& data, size_t chunk,
+                size_t threads, ThreadPool* pool) {
+    size_t chunks = data.size() / chunk;
+    size_t per = (chunks + threads - 1) / threads;
+    uint64_t sink = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = ticks();
+    if (threads == 1) {
+        sink = hash_range(k, data, chunk, 0, chunks * chunk);
+    } else {
+        std::vector<std::future<uint64_t>> parts;
+        for (size_t t = 0; t < threads; t++) {
+            size_t begin = std::min(chunks, t * per) * chunk;
+            size_t end = std::min(chunks, (t + 1) * per) * chunk;
+            parts.push_back(pool->enqueue(hash_range, std::cref(k), std::cref(data),
+                                          chunk, begin, end));
+        }
+        for (auto& p : parts) {
+            sink += p.get();
+        }
+    }
+    uint64_t c1 = ticks();
+    auto t1 = std::chrono::steady_clock::now();
+
+    double bytes = static_cast<double>(chunks * chunk);
+    double sec = std::chrono::duration<double>(t1 - t0).count();
+    printf("%s,%zu,%zu,%.0f,%.6f,%.4f,%.4f,%llu\n", k.name, chunk, threads, bytes, sec,
+           bytes / sec / 1e9, (c1 - c0) * threads / bytes,
+           static_cast<unsigned long long>(sink & 1));
+}
+
+int main(int argc, char* argv[]) {
+    size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : std::thread::hardware_concurrency();
+    max_threads = std::max<size_t>(max_threads, 1);
+    if (total < MAX_CHUNK) {
+        /* every run must hash at least one chunk of the largest size */
+        fprintf(stderr, "need at least %zu MiB per run\n", MAX_CHUNK >> 20);
+        return 1;
+    }
+
+    std::vector<char> data(total);
+    for (auto& c : data) {
+        c = static_cast<char>(rand() >> 7);
+    }
+
+    std::vector<Kernel> kernels = {
+        {"md5", [](const char* p, size_t n) {
+            return (uint64_t)MD5(reinterpret_cast<const byte*>(p), n).getFingerprint().w[0];
+        }},
+        {"crc32c", [](const char* p, size_t n) { return (uint64_t)crc32c(0, p, n); }},
+        {"crc32c_sw", [](const char* p, size_t n) { return (uint64_t)crc32c_sw(0, p, n); }},
+        {"sketch", [](const char* p, size_t n) {
+            return Sketch::of(p, static_cast<uint32_t>(n)).sf[0];
+        }},
+    };
+
+    std::vector<size_t> thread_counts = {1};
+    if (max_threads > 1) {
+        thread_counts.push_back(max_threads);
+    }
+    ThreadPool pool(max_threads);
+
+    printf("algo,chunk_bytes,threads,bytes,seconds,gbps,cycles_per_byte,sink\n");
+    for (auto& k : kernels) {
+        for (size_t chunk = 512; chunk <= MAX_CHUNK; chunk <<= 1) {
+            for (size_t threads : thread_counts) {
+                run(k, data, chunk, threads, &pool);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "fpstage.h"
+#include "md5.h"
+
+FingerprintStage::FingerprintStage(size_t workers, size_t batch_bytes, size_t max_inflight)
+    : batch_bytes(batch_bytes), max_inflight(max_inflight ? max_inflight : 1),
+      pool(workers) {
+}
+
+std::vector<Fingerprint128> FingerprintStage::hash(const ChunkBatch* batch) {
+    std::vector<Fingerprint128> digests;
+    digests.reserve(batch->views.size());
+    const byte* base = reinterpret_cast<const byte*>(batch->data.data());
+    for (auto& v : batch->views) {
+        MD5 m(base + v.offset, v.len);
+        digests.push_back(m.getFingerprint());
+    }
+    return digests;
+}
+
+void FingerprintStage::push(int fd_chunk, const char* block, uint32_t len,
+                            const chunk_block_entry& entry) {
+    if (current && (current->fd_chunk != fd_chunk ||
+                    current->data.size() + len > batch_bytes)) {
+        submit();
+    }
+    if (!current) {
+        if (!spare.empty()) {
+            current = std::move(spare.back());
+            spare.pop_back();
+        } else {
+            current.reset(new ChunkBatch());
+            current->data.reserve(batch_bytes);
+        }
+        current->fd_chunk = fd_chunk;
+    }
+    uint32_t offset = static_cast<uint32_t>(current->data.size());
+    current->data.append(block, len);
+    current->views.push_back(ChunkBatch::View{offset, len});
+    current->entries.push_back(entry);
+}
+
+void FingerprintStage::submit() {
+    if (!current || current->views.empty()) {
+        return;
+    }
+    while (inflight.size() >= max_inflight) {
+        retire();
+    }
+    const ChunkBatch* batch = current.get();
+    current->digests = pool.enqueue(hash, batch);
+    inflight.push_back(std::move(current));
+}
+
+void FingerprintStage::retire() {
+    std::unique_ptr<ChunkBatch> batch = std::move(inflight.front());
+    inflight.pop_front();
+
+    std::vector<Fingerprint128> digests = batch->digests.get();
+    for (size_t i = 0; i < digests.size(); i++) {
+        digests[i].to_bytes(batch->entries[i].md5);
+        batch->entries[i].md5[16] = 0;
+    }
+    size_t bytes = batch->entries.size() * CHUNK_BLOCK_ENTRY_SZ;
+    if (write(batch->fd_chunk, batch->entries.data(), bytes) != (ssize_t)bytes) {
+        throw std::runtime_error("fpstage: chunk entry write failed");
+    }
+
+    batch->data.clear();
+    batch->views.clear();
+    batch->entries.clear();
+    spare.push_back(std::move(batch));
+}
+
+void FingerprintStage::flush() {
+    submit();
+    while (!inflight.empty()) {
+        retire();
+    }
+}
+
+/* C bridge for cdc.c */
+
+struct _fp_stage {
+    _fp_stage(size_t workers, size_t batch_bytes, size_t max_inflight)
+        : stage(workers, batch_bytes, max_inflight) {}
+    FingerprintStage stage;
+};
+
+extern "C" {
+
+fp_stage *fp_stage_create(size_t workers, size_t batch_bytes, size_t max_inflight) {
+    return new fp_stage(workers, batch_bytes, max_inflight);
+}
+
+int fp_stage_push(fp_stage *fs, int fd_chunk, const char *block, uint32_t len,
+                  const chunk_block_entry *entry) {
+    try {
+        fs->stage.push(fd_chunk, block, len, *entry);
+        return 0;
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+int fp_stage_flush(fp_stage *fs) {
+    try {
+        fs->stage.flush();
+        return 0;
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+void fp_stage_destroy(fp_stage *fs) {
+    delete fs;
+}
+
+}
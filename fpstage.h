@@ -0,0 +1,67 @@
+#ifndef FPSTAGE_H
+#define FPSTAGE_H
+
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cdc.h"
+#include "fingerprint.h"
+#include "threadpool.h"
+
+/* A run of chunks copied back to back into one buffer. */
+struct ChunkBatch {
+    struct View {
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    int fd_chunk;
+    std::string data;
+    std::vector<View> views;
+    std::vector<chunk_block_entry> entries;
+    std::future<std::vector<Fingerprint128>> digests;
+};
+
+/*
+ * Fingerprint stage decoupled from the chunker.
+ *
+ * The chunker pushes each cut chunk with its prepared block entry; chunks
+ * accumulate in a batch until batch_bytes, then the whole batch is hashed
+ * by one pool task, so the chunking loop and the MD5 loop each stay hot
+ * in their own thread.  Batches finish out of order but are retired in
+ * order: digests are filled into the entries and the entries appended to
+ * the chunk file exactly as the inline path would have written them.
+ * At most max_inflight batches are outstanding before push() waits.
+ *
+ * push() and flush() must be called from a single thread.
+ */
+class FingerprintStage {
+public:
+    FingerprintStage(size_t workers, size_t batch_bytes, size_t max_inflight);
+
+    void push(int fd_chunk, const char* block, uint32_t len, const chunk_block_entry& entry);
+
+    /* Hash the partial batch and write out everything pushed so far. */
+    void flush();
+
+private:
+    static std::vector<Fingerprint128> hash(const ChunkBatch* batch);
+
+    void submit();
+    void retire();
+
+    size_t batch_bytes;
+    size_t max_inflight;
+
+    std::unique_ptr<ChunkBatch> current;
+    std::deque<std::unique_ptr<ChunkBatch>> inflight;
+    std::vector<std::unique_ptr<ChunkBatch>> spare;
+
+    ThreadPool pool;
+};
+
+#endif
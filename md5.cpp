@@ -8,10 +8,76 @@
  *
  */
 
+#include <utility>
+
 #include "md5.h"
 
+namespace {
+
+/* Sine table, T[i] = floor(abs(sin(i + 1)) * 2^32). */
+constexpr bit32 T[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+/* Rotate amounts, four per round. */
+constexpr int S[16] = {
+  7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+/* Message word used by step i. */
+constexpr size_t word(size_t i) {
+  return i < 16 ? i
+       : i < 32 ? (5 * i + 1) % 16
+       : i < 48 ? (3 * i + 5) % 16
+       : (7 * i) % 16;
+}
+
+inline bit32 load32(const byte* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  bit32 x;
+  memcpy(&x, p, 4);
+  return x;
+#else
+  return ((bit32)p[0]) | (((bit32)p[1]) << 8) |
+    (((bit32)p[2]) << 16) | (((bit32)p[3]) << 24);
+#endif
+}
+
+inline bit32 rotl(bit32 x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+/* Round functions F, G, H, I; F and G in their select-free forms. */
+template <size_t Round> bit32 fn(bit32 x, bit32 y, bit32 z);
+template <> inline bit32 fn<0>(bit32 x, bit32 y, bit32 z) { return z ^ (x & (y ^ z)); }
+template <> inline bit32 fn<1>(bit32 x, bit32 y, bit32 z) { return y ^ (z & (x ^ y)); }
+template <> inline bit32 fn<2>(bit32 x, bit32 y, bit32 z) { return x ^ y ^ z; }
+template <> inline bit32 fn<3>(bit32 x, bit32 y, bit32 z) { return y ^ (x | ~z); }
+
+/* Step i works on (a, b, c, d) rotated right by i % 4 positions, so the
+ * registers never move and the whole block unrolls to straight-line code. */
+template <size_t I>
+inline void step(bit32 (&v)[4], const byte* block) {
+  constexpr size_t a = (4 - I % 4) % 4, b = (a + 1) % 4, c = (a + 2) % 4, d = (a + 3) % 4;
+  v[a] = v[b] + rotl(v[a] + fn<I / 16>(v[b], v[c], v[d]) + load32(block + 4 * word(I)) + T[I],
+                     S[I / 16 * 4 + I % 4]);
+}
+
+template <size_t... I>
+inline void steps(bit32 (&v)[4], const byte* block, std::index_sequence<I...>) {
+  (step<I>(v, block), ...);
+}
+
+}
+
 /* Define the static member of MD5. */
-const byte MD5::PADDING[64] = { 0x80 };
 const char MD5::HEX_NUMBERS[16] = {
   '0', '1', '2', '3',
   '4', '5', '6', '7',
@@ -19,6 +85,14 @@ const char MD5::HEX_NUMBERS[16] = {
   'c', 'd', 'e', 'f'
 };
 
+/**
+ * @Construct a MD5 object of an empty message.
+ *
+ */
+MD5::MD5() {
+  reset();
+}
+
 /**
  * @Construct a MD5 object with a string.
  *
@@ -26,17 +100,48 @@ const char MD5::HEX_NUMBERS[16] = {
  *
  */
 MD5::MD5(const string& message) {
+  reset();
+
+  /* Initialization the object according to message. */
+  init((const byte*)message.c_str(), message.length());
+}
+
+/**
+ * @Construct a MD5 object with a raw buffer.
+ *
+ * @param {input} the bytes will be transformed.
+ *
+ * @param {length} the number byte of input.
+ *
+ */
+MD5::MD5(const byte* input, size_t length) {
+  reset();
+  init(input, length);
+}
+
+/**
+ * @Reset number of bits and load the initialization constants.
+ *
+ */
+void MD5::reset() {
   finished = false;
-  /* Reset number of bits. */
   count[0] = count[1] = 0;
-  /* Initialization constants. */
   state[0] = 0x67452301;
   state[1] = 0xefcdab89;
   state[2] = 0x98badcfe;
   state[3] = 0x10325476;
+}
 
-  /* Initialization the object according to message. */
-  init((const byte*)message.c_str(), message.length());
+/**
+ * @Append more message bytes.
+ *
+ * @param {input} the bytes will be transformed.
+ *
+ * @param {length} the number byte of input.
+ *
+ */
+void MD5::update(const byte* input, size_t length) {
+  init(input, length);
 }
 
 /**
@@ -49,32 +154,22 @@ const byte* MD5::getDigest() {
   if (!finished) {
     finished = true;
 
-    byte bits[8];
-    bit32 oldState[4];
-    bit32 oldCount[2];
-    bit32 index, padLen;
-
-    /* Save current state and count. */
-    memcpy(oldState, state, 16);
-    memcpy(oldCount, count, 8);
-
-    /* Save number of bits */
-    encode(count, bits, 8);
-
-    /* Pad out to 56 mod 64. */
-    index = (bit32)((count[0] >> 3) & 0x3f);
-    padLen = (index < 56) ? (56 - index) : (120 - index);
-    init(PADDING, padLen);
-
-    /* Append length (before padding) */
-    init(bits, 8);
+    /* Pad a copy of the tail to 56 mod 64 and append the bit count, so
+     * the running state stays untouched for further updates. */
+    byte tail[128] = { 0 };
+    bit32 st[4] = { state[0], state[1], state[2], state[3] };
+    bit32 index = (bit32)((count[0] >> 3) & 0x3f);
+    bit32 blocks = (index < 56) ? 1 : 2;
+
+    memcpy(tail, buffer, index);
+    tail[index] = 0x80;
+    encode(count, tail + blocks * 64 - 8, 8);
+    for (bit32 i = 0; i < blocks; ++i) {
+      transform(st, tail + i * 64);
+    }
 
     /* Store state in digest */
-    encode(state, digest, 16);
-
-    /* Restore current state and count. */
-    memcpy(state, oldState, 16);
-    memcpy(count, oldCount, 8);
+    encode(st, digest, 16);
   }
   return digest;
 }
@@ -93,6 +188,9 @@ void MD5::init(const byte* input, size_t len) {
   bit32 i, index, partLen;
 
   finished = false;
+  if (len == 0) {
+    return;
+  }
 
   /* Compute number of bytes mod 64 */
   index = (bit32)((count[0] >> 3) & 0x3f);
@@ -109,10 +207,10 @@ void MD5::init(const byte* input, size_t len) {
   if (len >= partLen) {
 
     memcpy(&buffer[index], input, partLen);
-    transform(buffer);
+    transform(state, buffer);
 
     for (i = partLen; i + 63 < len; i += 64) {
-      transform(&input[i]);
+      transform(state, &input[i]);
     }
     index = 0;
 
@@ -127,90 +225,20 @@ void MD5::init(const byte* input, size_t len) {
 /**
  * @MD5 basic transformation. Transforms state based on block.
  *
+ * @param {state} the chaining state.
+ *
  * @param {block} the message block.
  */
-void MD5::transform(const byte block[64]) {
-
-  bit32 a = state[0], b = state[1], c = state[2], d = state[3], x[16];
-
-  decode(block, x, 64);
-
-  /* Round 1 */
-  FF (a, b, c, d, x[ 0], s11, 0xd76aa478);
-  FF (d, a, b, c, x[ 1], s12, 0xe8c7b756);
-  FF (c, d, a, b, x[ 2], s13, 0x242070db);
-  FF (b, c, d, a, x[ 3], s14, 0xc1bdceee);
-  FF (a, b, c, d, x[ 4], s11, 0xf57c0faf);
-  FF (d, a, b, c, x[ 5], s12, 0x4787c62a);
-  FF (c, d, a, b, x[ 6], s13, 0xa8304613);
-  FF (b, c, d, a, x[ 7], s14, 0xfd469501);
-  FF (a, b, c, d, x[ 8], s11, 0x698098d8);
-  FF (d, a, b, c, x[ 9], s12, 0x8b44f7af);
-  FF (c, d, a, b, x[10], s13, 0xffff5bb1);
-  FF (b, c, d, a, x[11], s14, 0x895cd7be);
-  FF (a, b, c, d, x[12], s11, 0x6b901122);
-  FF (d, a, b, c, x[13], s12, 0xfd987193);
-  FF (c, d, a, b, x[14], s13, 0xa679438e);
-  FF (b, c, d, a, x[15], s14, 0x49b40821);
-
-  /* Round 2 */
-  GG (a, b, c, d, x[ 1], s21, 0xf61e2562);
-  GG (d, a, b, c, x[ 6], s22, 0xc040b340);
-  GG (c, d, a, b, x[11], s23, 0x265e5a51);
-  GG (b, c, d, a, x[ 0], s24, 0xe9b6c7aa);
-  GG (a, b, c, d, x[ 5], s21, 0xd62f105d);
-  GG (d, a, b, c, x[10], s22,  0x2441453);
-  GG (c, d, a, b, x[15], s23, 0xd8a1e681);
-  GG (b, c, d, a, x[ 4], s24, 0xe7d3fbc8);
-  GG (a, b, c, d, x[ 9], s21, 0x21e1cde6);
-  GG (d, a, b, c, x[14], s22, 0xc33707d6);
-  GG (c, d, a, b, x[ 3], s23, 0xf4d50d87);
-  GG (b, c, d, a, x[ 8], s24, 0x455a14ed);
-  GG (a, b, c, d, x[13], s21, 0xa9e3e905);
-  GG (d, a, b, c, x[ 2], s22, 0xfcefa3f8);
-  GG (c, d, a, b, x[ 7], s23, 0x676f02d9);
-  GG (b, c, d, a, x[12], s24, 0x8d2a4c8a);
-
-  /* Round 3 */
-  HH (a, b, c, d, x[ 5], s31, 0xfffa3942);
-  HH (d, a, b, c, x[ 8], s32, 0x8771f681);
-  HH (c, d, a, b, x[11], s33, 0x6d9d6122);
-  HH (b, c, d, a, x[14], s34, 0xfde5380c);
-  HH (a, b, c, d, x[ 1], s31, 0xa4beea44);
-  HH (d, a, b, c, x[ 4], s32, 0x4bdecfa9);
-  HH (c, d, a, b, x[ 7], s33, 0xf6bb4b60);
-  HH (b, c, d, a, x[10], s34, 0xbebfbc70);
-  HH (a, b, c, d, x[13], s31, 0x289b7ec6);
-  HH (d, a, b, c, x[ 0], s32, 0xeaa127fa);
-  HH (c, d, a, b, x[ 3], s33, 0xd4ef3085);
-  HH (b, c, d, a, x[ 6], s34,  0x4881d05);
-  HH (a, b, c, d, x[ 9], s31, 0xd9d4d039);
-  HH (d, a, b, c, x[12], s32, 0xe6db99e5);
-  HH (c, d, a, b, x[15], s33, 0x1fa27cf8);
-  HH (b, c, d, a, x[ 2], s34, 0xc4ac5665);
-
-  /* Round 4 */
-  II (a, b, c, d, x[ 0], s41, 0xf4292244);
-  II (d, a, b, c, x[ 7], s42, 0x432aff97);
-  II (c, d, a, b, x[14], s43, 0xab9423a7);
-  II (b, c, d, a, x[ 5], s44, 0xfc93a039);
-  II (a, b, c, d, x[12], s41, 0x655b59c3);
-  II (d, a, b, c, x[ 3], s42, 0x8f0ccc92);
-  II (c, d, a, b, x[10], s43, 0xffeff47d);
-  II (b, c, d, a, x[ 1], s44, 0x85845dd1);
-  II (a, b, c, d, x[ 8], s41, 0x6fa87e4f);
-  II (d, a, b, c, x[15], s42, 0xfe2ce6e0);
-  II (c, d, a, b, x[ 6], s43, 0xa3014314);
-  II (b, c, d, a, x[13], s44, 0x4e0811a1);
-  II (a, b, c, d, x[ 4], s41, 0xf7537e82);
-  II (d, a, b, c, x[11], s42, 0xbd3af235);
-  II (c, d, a, b, x[ 2], s43, 0x2ad7d2bb);
-  II (b, c, d, a, x[ 9], s44, 0xeb86d391);
-
-  state[0] += a;
-  state[1] += b;
-  state[2] += c;
-  state[3] += d;
+void MD5::transform(bit32 state[4], const byte block[64]) {
+
+  bit32 v[4] = { state[0], state[1], state[2], state[3] };
+
+  steps(v, block, std::make_index_sequence<64>());
+
+  state[0] += v[0];
+  state[1] += v[1];
+  state[2] += v[2];
+  state[3] += v[3];
 }
 
 /**
@@ -234,23 +262,15 @@ void MD5::encode(const bit32* input, byte* output, size_t length) {
 }
 
 /**
- * @Decodes input (byte) into output (usigned long).
- *
- * @param {input} bytes.
- *
- * @param {output} unsigned long.
+ * @Generate md5 digest as a fingerprint value.
  *
- * @param {length} the length of input.
+ * @return the message-digest.
  *
  */
-void MD5::decode(const byte* input, bit32* output, size_t length) {
-  for (size_t i = 0, j = 0; j < length; ++i, j += 4) {
-    output[i] = ((bit32)input[j]) | (((bit32)input[j + 1]) << 8) |
-    (((bit32)input[j + 2]) << 16) | (((bit32)input[j + 3]) << 24);
-  }
+Fingerprint128 MD5::getFingerprint() {
+  return Fingerprint128::from_bytes(getDigest());
 }
 
-
 /**
  * @Convert digest to string value.
  *
@@ -270,3 +290,40 @@ string MD5::toStr() {
   }
   return str;
 }
+
+/**
+ * @Digest a chunk for the C chunker.
+ *
+ * @param {input} the chunk.
+ *
+ * @param {length} the number byte of chunk.
+ *
+ * @param {digest} receives 16 digest bytes and a NUL.
+ *
+ */
+extern "C" void md5(const char* input, size_t length, unsigned char digest[17]) {
+  MD5 m((const byte*)input, length);
+  memcpy(digest, m.getDigest(), 16);
+  digest[16] = 0;
+}
+
+/**
+ * @Running digest over several buffers for the C chunker.
+ */
+struct _md5_stream {
+  MD5 m;
+};
+
+extern "C" md5_stream* md5_stream_create() {
+  return new md5_stream();
+}
+
+extern "C" void md5_stream_update(md5_stream* stream, const char* input, size_t length) {
+  stream->m.update((const byte*)input, length);
+}
+
+extern "C" void md5_stream_final(md5_stream* stream, unsigned char digest[17]) {
+  memcpy(digest, stream->m.getDigest(), 16);
+  digest[16] = 0;
+  delete stream;
+}
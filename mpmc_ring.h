@@ -0,0 +1,94 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Bounded multi-producer multi-consumer ring (Vyukov).
+ *
+ * Every cell carries a sequence number that tells producers and consumers
+ * whose turn it is, so a push or pop is one CAS on the tail or head plus
+ * a store to the cell; nothing blocks and nothing allocates after
+ * construction.  try_push fails instead of growing when the ring is full.
+ * T must be trivially copyable, the pool stores task pointers.
+ */
+template <class T>
+class MpmcRing {
+public:
+    explicit MpmcRing(size_t capacity)
+        : mask(round_up(capacity) - 1), cells(new Cell[mask + 1]), head(0), tail(0) {
+        for (size_t i = 0; i <= mask; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpmcRing() { delete[] cells; }
+
+    MpmcRing(const MpmcRing&) = delete;
+    MpmcRing& operator=(const MpmcRing&) = delete;
+
+    bool try_push(T x) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.data = x;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;   /* full */
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& x) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    x = c.data;
+                    c.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;   /* empty */
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static size_t round_up(size_t n) {
+        size_t c = 2;
+        while (c < n) {
+            c <<= 1;
+        }
+        return c;
+    }
+
+    const size_t mask;
+    Cell* const cells;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "threadpool.h"
+
+/*
+ * Loop and pipeline helpers on top of ThreadPool.
+ *
+ * parallel_for and parallel_reduce split [begin, end) into chunks of
+ * grain indices.  Up to pool.size() helper tasks and the calling thread
+ * claim chunks from a shared counter until none are left, so the caller
+ * never sits idle and calling from inside a pool task cannot deadlock:
+ * the caller only waits for chunks some running thread already claimed.
+ * The first exception thrown by fn stops further claims and is rethrown
+ * to the caller.  ThreadPool::scratch() is rewound after every chunk, on
+ * the calling thread as well as on the workers.
+ */
+
+/* Shared by the helpers of one loop.  A helper that starts after the
+ * last chunk was claimed only touches this state, never the caller's
+ * stack, so it may outlive the call. */
+struct ChunkLoop {
+    ChunkLoop(size_t begin, size_t end, size_t grain)
+        : begin(begin), end(end), grain(grain ? grain : 1),
+          chunks((end - begin + this->grain - 1) / this->grain),
+          next(0), done(0), failed(false) {}
+
+    /* Claim and run chunks until none are left. */
+    template <class Body>
+    void work(const Body& body) {
+        for (;;) {
+            size_t c = next.fetch_add(1);
+            if (c >= chunks) {
+                return;
+            }
+            size_t lo = begin + c * grain;
+            size_t hi = std::min(end, lo + grain);
+            if (!failed) {
+                /* chunk-lived scratch, also for the calling thread */
+                ArenaScope scratch(ThreadPool::scratch());
+                try {
+                    body(c, lo, hi);
+                } catch (...) {
+                    fail();
+                }
+            }
+            finish();
+        }
+    }
+
+    void fail() {
+        if (!failed.exchange(true)) {
+            error = std::current_exception();
+        }
+    }
+
+    void finish() {
+        if (done.fetch_add(1) + 1 == chunks) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cv.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]{ return done == chunks; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    const size_t begin;
+    const size_t end;
+    const size_t grain;
+    const size_t chunks;
+    std::atomic<size_t> next;
+    std::atomic<size_t> done;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+/* Run body(chunk, lo, hi) over every chunk of [begin, end). */
+template <class Body>
+void parallel_chunks(ThreadPool& pool, size_t begin, size_t end, size_t grain, const Body& body) {
+    if (end <= begin) {
+        return;
+    }
+    auto loop = std::make_shared<ChunkLoop>(begin, end, grain);
+    size_t helpers = std::min(pool.size(), loop->chunks - 1);
+    const Body* shared_body = &body;
+    for (size_t i = 0; i < helpers; i++) {
+        pool.post([loop, shared_body]{ loop->work(*shared_body); });
+    }
+    loop->work(body);
+    loop->wait();
+}
+
+/* fn(i) for every i in [begin, end). */
+template <class F>
+void parallel_for(ThreadPool& pool, size_t begin, size_t end, size_t grain, F fn) {
+    parallel_chunks(pool, begin, end, grain, [&fn](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            fn(i);
+        }
+    });
+}
+
+/* Fold combine(acc, map(i)) over [begin, end).  Each chunk starts from
+ * identity and the chunk results are combined in index order, so combine
+ * need only be associative. */
+template <class T, class Map, class Combine>
+T parallel_reduce(ThreadPool& pool, size_t begin, size_t end, size_t grain,
+                  T identity, Map map, Combine combine) {
+    if (end <= begin) {
+        return identity;
+    }
+    size_t g = grain ? grain : 1;
+    std::vector<T> partial((end - begin + g - 1) / g, identity);
+    parallel_chunks(pool, begin, end, g, [&](size_t c, size_t lo, size_t hi) {
+        T acc = identity;
+        for (size_t i = lo; i < hi; i++) {
+            acc = combine(std::move(acc), map(i));
+        }
+        partial[c] = std::move(acc);
+    });
+    T result = identity;
+    for (auto& p : partial) {
+        result = combine(std::move(result), std::move(p));
+    }
+    return result;
+}
+
+/*
+ * Bounded queue between two pipeline stages, holding items by their
+ * source sequence number.  pop() hands out the lowest number queued.  An
+ * ordered queue hands out exactly the next number instead, waiting for
+ * it, and push() admits only numbers within capacity of it, so whatever
+ * runs ahead of a late item waits upstream rather than piling up here.
+ * close() lets pop() drain and then fail, abort() makes both fail at once.
+ */
+template <class T>
+class StageQueue {
+public:
+    explicit StageQueue(size_t capacity, bool ordered = false)
+        : capacity(capacity ? capacity : 1), ordered(ordered), next(0),
+          closed(false), aborted(false) {}
+
+    bool push(uint64_t seq, T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this, seq]{
+            return aborted || (ordered ? seq - next < capacity : items.size() < capacity);
+        });
+        if (aborted) {
+            return false;
+        }
+        items.emplace(seq, std::move(item));
+        wake(not_empty);
+        return true;
+    }
+
+    bool pop(uint64_t& seq, T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]{ return aborted || ready() || (closed && items.empty()); });
+        if (aborted || items.empty()) {
+            return false;
+        }
+        auto it = items.begin();
+        seq = it->first;
+        item = std::move(it->second);
+        items.erase(it);
+        next = seq + 1;
+        wake(not_full);
+        if (ordered) {
+            not_empty.notify_all();
+        }
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lock(mutex);
+        aborted = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    bool ready() const {
+        return !items.empty() && (!ordered || items.begin()->first == next);
+    }
+    /* an ordered queue's waiters each want a different number */
+    void wake(std::condition_variable& cv) {
+        if (ordered) {
+            cv.notify_all();
+        } else {
+            cv.notify_one();
+        }
+    }
+
+    const size_t capacity;
+    const bool ordered;
+    std::map<uint64_t, T> items;
+    uint64_t next;          /* ordered: the number pop() waits for */
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    bool closed;
+    bool aborted;
+};
+
+/*
+ * Staged pipeline: a source on the calling thread feeds items through
+ * stages joined by bounded queues, e.g. read -> chunk -> hash -> index.
+ *
+ *     Pipeline<Item> p(pool, 64);
+ *     p.stage(1, chunk).stage(8, hash).stage(1, index);
+ *     p.run([&](Item& it) { return read_next(it); });
+ *
+ * A stage with one thread sees items in source order; a wider stage
+ * processes them concurrently and out of order, and the queue after it
+ * puts them back in order.  Each stage thread is a pool task that blocks
+ * on its queues for the whole run, so the stage thread counts must not
+ * add up to more than pool.max_size(), or one less when run() is called
+ * from a pool task, whose worker waits too.  If a stage throws, every
+ * queue is aborted and run() rethrows the first exception.
+ */
+template <class T>
+class Pipeline {
+public:
+    Pipeline(ThreadPool& pool, size_t capacity) : pool(pool), capacity(capacity) {}
+
+    Pipeline& stage(size_t threads, std::function<void(T&)> fn) {
+        stages.push_back(Stage{threads ? threads : 1, std::move(fn)});
+        return *this;
+    }
+
+    /* Pull items from source until it returns false, then wait for every
+     * item to leave the last stage. */
+    void run(std::function<bool(T&)> source);
+
+private:
+    struct Stage {
+        size_t threads;
+        std::function<void(T&)> fn;
+    };
+
+    struct Run {
+        std::vector<std::unique_ptr<StageQueue<T>>> queues;
+        std::vector<std::atomic<size_t>> running;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+
+        /* the queue after a wide stage restores the source order */
+        Run(const std::vector<Stage>& stages, size_t capacity)
+            : running(stages.size()), failed(false) {
+            for (size_t i = 0; i < stages.size(); i++) {
+                bool ordered = i > 0 && stages[i - 1].threads > 1;
+                queues.emplace_back(new StageQueue<T>(capacity, ordered));
+            }
+        }
+        void fail() {
+            if (!failed.exchange(true)) {
+                error = std::current_exception();
+            }
+            for (auto& q : queues) {
+                q->abort();
+            }
+        }
+    };
+
+    void serve(Run& r, size_t s);
+
+    ThreadPool& pool;
+    size_t capacity;
+    std::vector<Stage> stages;
+};
+
+template <class T>
+void Pipeline<T>::serve(Run& r, size_t s) {
+    StageQueue<T>& in = *r.queues[s];
+    StageQueue<T>* out = s + 1 < stages.size() ? r.queues[s + 1].get() : nullptr;
+    try {
+        uint64_t seq;
+        T item;
+        while (in.pop(seq, item)) {
+            stages[s].fn(item);
+            if (out && !out->push(seq, std::move(item))) {
+                return;
+            }
+        }
+    } catch (...) {
+        r.fail();
+    }
+    if (out && --r.running[s] == 0) {
+        out->close();
+    }
+}
+
+template <class T>
+void Pipeline<T>::run(std::function<bool(T&)> source) {
+    if (stages.empty()) {
+        T item;
+        while (source(item)) {
+        }
+        return;
+    }
+    size_t threads = 0;
+    for (auto& st : stages) {
+        threads += st.threads;
+    }
+    if (threads + (pool.is_worker() ? 1 : 0) > pool.max_size()) {
+        throw std::invalid_argument("pipeline needs more threads than the pool has");
+    }
+
+    Run r(stages, capacity);
+    TaskGroup group;
+    for (size_t s = 0; s < stages.size(); s++) {
+        r.running[s] = stages[s].threads;
+        for (size_t t = 0; t < stages[s].threads; t++) {
+            pool.post(group, [this, &r, s]{ serve(r, s); });
+        }
+    }
+
+    try {
+        uint64_t seq = 0;
+        T item;
+        while (!r.failed && source(item)) {
+            if (!r.queues[0]->push(seq++, std::move(item))) {
+                break;
+            }
+            item = T();
+        }
+    } catch (...) {
+        r.fail();
+    }
+    r.queues[0]->close();
+    group.wait();
+    if (r.error) {
+        std::rethrow_exception(r.error);
+    }
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef POOL_METRICS_H
+#define POOL_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* Power-of-two histogram: bucket b counts values in [2^(b-1), 2^b). */
+struct Log2Histogram {
+    static constexpr size_t BUCKETS = 48;
+
+    uint64_t counts[BUCKETS] = {};
+
+    static size_t bucket(uint64_t v) {
+        size_t b = v ? 64 - __builtin_clzll(v) : 0;
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+
+    uint64_t total() const {
+        uint64_t n = 0;
+        for (uint64_t c : counts) {
+            n += c;
+        }
+        return n;
+    }
+
+    /* Upper bound of the bucket holding the p-th fraction, 0 <= p <= 1. */
+    uint64_t percentile(double p) const {
+        uint64_t n = total();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p * (n - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank) {
+                return b ? (uint64_t(1) << b) - 1 : 0;
+            }
+        }
+        return ~uint64_t(0);
+    }
+
+    void merge(const Log2Histogram& o) {
+        for (size_t b = 0; b < BUCKETS; b++) {
+            counts[b] += o.counts[b];
+        }
+    }
+};
+
+/* Counters of one worker, or of the whole pool when summed. */
+struct WorkerMetrics {
+    uint64_t executed = 0;
+    uint64_t steals = 0;
+    uint64_t inline_runs = 0;   /* own submissions run because the pool was full */
+    uint64_t idle_ns = 0;
+    Log2Histogram wait_ns;      /* submit to start, sampled tasks only */
+    Log2Histogram run_ns;       /* start to end, sampled tasks only */
+
+    void merge(const WorkerMetrics& o) {
+        executed += o.executed;
+        steals += o.steals;
+        inline_runs += o.inline_runs;
+        idle_ns += o.idle_ns;
+        wait_ns.merge(o.wait_ns);
+        run_ns.merge(o.run_ns);
+    }
+};
+
+struct PoolMetrics {
+    size_t threads = 0;
+    size_t queued = 0;          /* tasks waiting at snapshot time */
+    size_t sleeping = 0;        /* workers parked at snapshot time */
+    uint64_t full_events = 0;   /* submissions that found the pool full */
+    WorkerMetrics total;
+    std::vector<WorkerMetrics> workers;
+
+    /* One line for the pool, then one per worker. */
+    std::string to_string() const {
+        std::string out;
+        char line[256];
+        auto row = [&](const char* who, const WorkerMetrics& m) {
+            snprintf(line, sizeof(line),
+                     "%s executed=%llu steals=%llu inline=%llu idle_ms=%.1f "
+                     "wait_ns p50=%llu p99=%llu run_ns p50=%llu p99=%llu\n",
+                     who, (unsigned long long)m.executed, (unsigned long long)m.steals,
+                     (unsigned long long)m.inline_runs, m.idle_ns / 1e6,
+                     (unsigned long long)m.wait_ns.percentile(0.5),
+                     (unsigned long long)m.wait_ns.percentile(0.99),
+                     (unsigned long long)m.run_ns.percentile(0.5),
+                     (unsigned long long)m.run_ns.percentile(0.99));
+            out += line;
+        };
+        snprintf(line, sizeof(line), "pool threads=%zu queued=%zu sleeping=%zu full=%llu\n",
+                 threads, queued, sleeping, (unsigned long long)full_events);
+        out += line;
+        row("total", total);
+        for (size_t i = 0; i < workers.size(); i++) {
+            char who[32];
+            snprintf(who, sizeof(who), "worker %zu", i);
+            row(who, workers[i]);
+        }
+        return out;
+    }
+};
+
+/*
+ * Live counters of one worker.  Only the owning worker writes them, with
+ * plain relaxed load/store pairs, so recording costs no locked
+ * instruction; snapshot() may run on any thread at any time.
+ */
+struct alignas(64) WorkerCounters {
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> inline_runs{0};
+    std::atomic<uint64_t> idle_ns{0};
+    std::atomic<uint64_t> wait_ns[Log2Histogram::BUCKETS] = {};
+    std::atomic<uint64_t> run_ns[Log2Histogram::BUCKETS] = {};
+
+    static void bump(std::atomic<uint64_t>& c, uint64_t by = 1) {
+        c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    WorkerMetrics snapshot() const {
+        WorkerMetrics m;
+        m.executed = executed.load(std::memory_order_relaxed);
+        m.steals = steals.load(std::memory_order_relaxed);
+        m.inline_runs = inline_runs.load(std::memory_order_relaxed);
+        m.idle_ns = idle_ns.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < Log2Histogram::BUCKETS; b++) {
+            m.wait_ns.counts[b] = wait_ns[b].load(std::memory_order_relaxed);
+            m.run_ns.counts[b] = run_ns[b].load(std::memory_order_relaxed);
+        }
+        return m;
+    }
+};
+
+#endif
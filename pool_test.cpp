@@ -0,0 +1,758 @@
+/*
+ * ThreadPool checks: ordering, nesting, exceptions and shutdown in every
+ * scheduling mode, plus the pieces underneath (Chase-Lev deque, MPMC
+ * ring, task nodes, scratch arena) and the helpers on top (parallel.h,
+ * coro.h).
+ *
+ *   g++ -std=c++20 -O2 -pthread pool_test.cpp -o pool_test
+ *   ./pool_test
+ *
+ * With -std=c++17 the coroutine checks are left out.  Exits non-zero on
+ * the first failed check.
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "coro.h"
+#include "parallel.h"
+#include "threadpool.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+/* True if fn throws an E. */
+template <class E, class F>
+static bool throws(F fn) {
+    try {
+        fn();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+struct Mode {
+    const char* name;
+    ThreadPoolOptions options;
+};
+
+static std::vector<Mode> modes() {
+    ThreadPoolOptions base;
+    base.threads = 4;
+    std::vector<Mode> m;
+    auto add = [&](const char* name) -> ThreadPoolOptions& {
+        m.push_back(Mode{name, base});
+        return m.back().options;
+    };
+    add("fifo");
+    add("stealing").work_stealing = true;
+    add("ring").ring_capacity = 64;
+    ThreadPoolOptions& numa = add("numa");
+    numa.numa_aware = true;
+    numa.pin_threads = true;
+    add("bounded").max_queued = 8;
+    ThreadPoolOptions& stealing_ring = add("stealing_ring");
+    stealing_ring.work_stealing = true;
+    stealing_ring.ring_capacity = 16;
+    stealing_ring.max_queued = 8;
+    add("lanes").lane_weights = {4, 1};
+    ThreadPoolOptions& metrics = add("metrics");
+    metrics.metrics = true;
+    metrics.metrics_sample = 1;
+    ThreadPoolOptions& elastic = add("elastic");
+    elastic.threads = 1;
+    elastic.max_threads = 4;
+    elastic.grow_after = std::chrono::milliseconds(1);
+    elastic.retire_after = std::chrono::milliseconds(50);
+    return m;
+}
+
+/* One worker takes outside submissions in submission order. */
+static void check_order(const Mode& mode) {
+    ThreadPoolOptions o = mode.options;
+    o.threads = 1;
+    o.max_threads = 0;
+    std::vector<int> seen;
+    {
+        ThreadPool pool(o);
+        for (int i = 0; i < 200; i++) {
+            /* one node's queue, so a multi-node pool keeps the order too */
+            if (o.numa_aware) {
+                pool.post_on(0, [&seen, i]{ seen.push_back(i); });
+            } else {
+                pool.post([&seen, i]{ seen.push_back(i); });
+            }
+        }
+    }
+    CHECK(seen.size() == 200);
+    for (int i = 0; i < 200; i++) {
+        CHECK(seen[i] == i);
+    }
+}
+
+/* Tasks that submit tasks, and loops inside tasks. */
+static void check_nesting(const Mode& mode) {
+    ThreadPool pool(mode.options);
+    std::atomic<size_t> inner(0), looped(0);
+    TaskGroup group;
+    for (int i = 0; i < 8; i++) {
+        pool.post(group, [&]{
+            for (int k = 0; k < 50; k++) {
+                pool.post(group, [&inner]{ inner++; });
+            }
+            parallel_for(pool, 0, 1000, 16, [&looped](size_t) { looped++; });
+        });
+    }
+    group.wait();
+    CHECK(inner == 8 * 50);
+    CHECK(looped == 8 * 1000);
+
+    /* futures from inside a task, waited on by the caller */
+    auto outer = pool.enqueue([&pool]{
+        std::vector<std::future<int>> parts;
+        for (int i = 0; i < 20; i++) {
+            parts.push_back(pool.enqueue([i]{ return i; }));
+        }
+        return parts;
+    });
+    int sum = 0;
+    for (auto& f : outer.get()) {
+        sum += f.get();
+    }
+    CHECK(sum == 190);
+}
+
+static void check_exceptions(const Mode& mode) {
+    ThreadPool pool(mode.options);
+    auto bad = pool.enqueue([]() -> int { throw std::runtime_error("task"); });
+    CHECK(throws<std::runtime_error>([&]{ bad.get(); }));
+
+    std::vector<int> items(100);
+    for (int i = 0; i < 100; i++) {
+        items[i] = i;
+    }
+    auto bulk = pool.enqueue_bulk(items.begin(), items.end(), [](int i) {
+        if (i == 7) {
+            throw std::runtime_error("bulk");
+        }
+        return i;
+    });
+    CHECK(throws<std::runtime_error>([&]{ bulk.get(); }));
+
+    CHECK(throws<std::runtime_error>([&]{
+        parallel_for(pool, 0, 1000, 10, [](size_t i) {
+            if (i == 500) {
+                throw std::runtime_error("loop");
+            }
+        });
+    }));
+
+    /* still fine afterwards */
+    CHECK(pool.enqueue([]{ return 42; }).get() == 42);
+    auto good = pool.enqueue_bulk(items.begin(), items.end(), [](int i) { return 2 * i; }).get();
+    for (int i = 0; i < 100; i++) {
+        CHECK(good[i] == 2 * i);
+    }
+}
+
+/* The destructor runs everything already queued before it returns. */
+static void check_shutdown(const Mode& mode) {
+    std::atomic<size_t> ran(0);
+    {
+        ThreadPool pool(mode.options);
+        for (int i = 0; i < 2000; i++) {
+            pool.post([&ran]{ ran++; });
+        }
+        /* queued from inside, possibly onto a worker's deque */
+        TaskGroup group;
+        pool.post(group, [&pool, &ran]{
+            for (int i = 0; i < 100; i++) {
+                pool.post([&ran]{ ran++; });
+            }
+        });
+        group.wait();
+    }
+    CHECK(ran == 2100);
+}
+
+/* A bulk submission to a bounded ring pool respects max_queued, waiting
+ * for room instead of filling the ring. */
+static void check_bounded_bulk() {
+    ThreadPoolOptions o;
+    o.threads = 1;
+    o.ring_capacity = 64;
+    o.max_queued = 4;
+    ThreadPool pool(o);
+
+    std::mutex gate;
+    std::unique_lock<std::mutex> closed(gate);
+    std::atomic<bool> started(false);
+    pool.post([&]{
+        started = true;
+        std::lock_guard<std::mutex> wait(gate);
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    std::vector<int> items(32);
+    for (int i = 0; i < 32; i++) {
+        items[i] = i;
+    }
+    std::future<std::vector<int>> bulk;
+    std::thread submitter([&]{
+        bulk = pool.enqueue_bulk(items.begin(), items.end(), [](int i) { return i + 1; });
+    });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool.metrics().full_events == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(pool.metrics().full_events > 0);
+    CHECK(pool.metrics().queued == 4);
+    CHECK(!pool.try_enqueue([]{}).valid());
+
+    closed.unlock();
+    submitter.join();
+    std::vector<int> r = bulk.get();
+    for (int i = 0; i < 32; i++) {
+        CHECK(r[i] == i + 1);
+    }
+}
+
+/* max_queued bounds the shared queue only: a worker fanning out onto
+ * its own deque leaves room for outside submitters. */
+static void check_bounded_deque() {
+    ThreadPoolOptions o;
+    o.threads = 1;
+    o.work_stealing = true;
+    o.max_queued = 4;
+    ThreadPool pool(o);
+
+    std::mutex gate;
+    std::unique_lock<std::mutex> closed(gate);
+    std::atomic<bool> started(false);
+    std::atomic<int> ran(0);
+    pool.post([&]{
+        for (int i = 0; i < 100; i++) {
+            pool.post([&ran]{ ran++; });
+        }
+        started = true;
+        std::lock_guard<std::mutex> wait(gate);
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    CHECK(pool.metrics().queued == 100);
+    auto a = pool.try_enqueue([]{ return 1; });
+    auto b = pool.try_enqueue_for(std::chrono::milliseconds(1), []{ return 2; });
+    CHECK(a.valid() && b.valid());
+
+    closed.unlock();
+    CHECK(a.get() + b.get() == 3);
+    while (ran < 100) {
+        std::this_thread::yield();
+    }
+}
+
+/* Lanes are checked at submission, and a ring has only one. */
+static void check_lanes() {
+    ThreadPoolOptions o;
+    o.threads = 2;
+    o.lane_weights = {2, 1};
+    ThreadPool pool(o);
+    CHECK(pool.lanes() == 2);
+    CHECK(pool.enqueue_lane(1, []{ return 3; }).get() == 3);
+    CHECK(throws<std::invalid_argument>([&]{ pool.post_lane(2, []{}); }));
+    CHECK(throws<std::invalid_argument>([&]{ pool.enqueue_lane(5, []{ return 0; }); }));
+
+    o.ring_capacity = 64;
+    CHECK(throws<std::invalid_argument>([&]{ ThreadPool ring(o); }));
+    o.lane_weights = {1};
+    ThreadPool single(o);
+    CHECK(throws<std::invalid_argument>([&]{ single.post_lane(1, []{}); }));
+}
+
+/* An elastic pool stamps every task for its grow check, but only one in
+ * metrics_sample is clocked. */
+static void check_sampling() {
+    ThreadPoolOptions o;
+    o.threads = 2;
+    o.max_threads = 4;
+    o.metrics = true;
+    o.metrics_sample = 4;
+    ThreadPool pool(o);
+    TaskGroup group;
+    for (int i = 0; i < 400; i++) {
+        pool.post(group, []{});
+    }
+    group.wait();
+    /* a worker counts the task just after the group hears of it */
+    PoolMetrics m = pool.metrics();
+    while (m.total.executed < 400) {
+        std::this_thread::yield();
+        m = pool.metrics();
+    }
+    CHECK(m.total.wait_ns.total() == 100 && m.total.run_ns.total() == 100);
+}
+
+static void check_deque() {
+    WorkDeque<int> d(4);
+    int x = 0;
+    CHECK(d.empty() && !d.pop(x) && !d.steal(x));
+    for (int i = 0; i < 100; i++) {
+        d.push(i);      /* grows past the initial 4 */
+    }
+    CHECK(d.steal(x) && x == 0);
+    CHECK(d.pop(x) && x == 99);
+    CHECK(d.steal(x) && x == 1);
+
+    /* owner pushes and pops while thieves steal; every item taken once */
+    const int N = 200000;
+    WorkDeque<int> q;
+    std::vector<std::atomic<int>> taken(N);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; t++) {
+        thieves.emplace_back([&]{
+            int v;
+            while (!done || !q.empty()) {
+                if (q.steal(v)) {
+                    taken[v]++;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < N; i++) {
+        q.push(i);
+        int v;
+        if (i % 3 == 0 && q.pop(v)) {
+            taken[v]++;
+        }
+    }
+    int v;
+    while (q.pop(v)) {
+        taken[v]++;
+    }
+    done = true;
+    for (auto& t : thieves) {
+        t.join();
+    }
+    for (int i = 0; i < N; i++) {
+        CHECK(taken[i] == 1);
+    }
+}
+
+static void check_ring() {
+    MpmcRing<int> r(5);     /* rounded up to 8 */
+    int pushed = 0;
+    while (r.try_push(pushed)) {
+        pushed++;
+    }
+    CHECK(pushed == 8);
+    int x;
+    for (int i = 0; i < 8; i++) {
+        CHECK(r.try_pop(x) && x == i);
+    }
+    CHECK(!r.try_pop(x));
+
+    const int N = 100000;
+    MpmcRing<int> q(64);
+    std::atomic<long> sum(0);
+    std::atomic<int> popped(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < 2; p++) {
+        threads.emplace_back([&q, p]{
+            for (int i = p; i < N; i += 2) {
+                while (!q.try_push(i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&]{
+            int v;
+            while (popped < N) {
+                if (q.try_pop(v)) {
+                    sum += v;
+                    popped++;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(popped == N && sum == (long)N * (N - 1) / 2);
+}
+
+/* Counts live copies, padded to the size asked for. */
+template <size_t Pad>
+struct Tracked {
+    static std::atomic<int> live;
+    int* ran;
+    char pad[Pad];
+    explicit Tracked(int* ran) : ran(ran) { live++; }
+    Tracked(const Tracked& o) : ran(o.ran) { live++; }
+    ~Tracked() { live--; }
+    void operator()() { ++*ran; }
+};
+template <size_t Pad>
+std::atomic<int> Tracked<Pad>::live(0);
+
+static void check_task_node() {
+    static_assert(sizeof(TaskNode) == 64, "one cache line");
+    int ran = 0;
+    TaskNode n;
+    n.set(Tracked<8>(&ran));            /* inline */
+    CHECK(Tracked<8>::live == 1);
+    n.run();
+    CHECK(ran == 1 && Tracked<8>::live == 0);
+    n.set(Tracked<256>(&ran));          /* heap */
+    CHECK(Tracked<256>::live == 1);
+    n.discard();
+    CHECK(ran == 1 && Tracked<256>::live == 0);
+
+    /* a thread's cache hands back what it was given */
+    TaskNode* a = TaskNodePool::get();
+    TaskNodePool::put(a);
+    CHECK(TaskNodePool::get() == a);
+    TaskNodePool::put(a);
+
+    /* nodes freed on other threads come back through the depot */
+    std::vector<TaskNode*> nodes;
+    for (size_t i = 0; i < 4 * TaskNodePool::BATCH; i++) {
+        nodes.push_back(TaskNodePool::get());
+    }
+    std::thread([&nodes]{
+        for (auto* t : nodes) {
+            TaskNodePool::put(t);
+        }
+    }).join();
+    for (size_t i = 0; i < 4 * TaskNodePool::BATCH; i++) {
+        TaskNodePool::put(TaskNodePool::get());
+    }
+
+    /* TaskGroup is reusable once wait() returns */
+    ThreadPool pool(4);
+    TaskGroup group;
+    for (int round = 0; round < 3; round++) {
+        std::atomic<int> count(0);
+        for (int i = 0; i < 1000; i++) {
+            pool.post(group, [&count]{ count++; });
+        }
+        group.wait();
+        CHECK(count == 1000);
+    }
+}
+
+static void check_arena() {
+    BumpArena a(1024);
+    CHECK(a.capacity() == 0);           /* nothing until first use */
+    char* p = static_cast<char*>(a.alloc(3, 1));
+    void* q = a.alloc(8, 64);
+    CHECK(reinterpret_cast<uintptr_t>(q) % 64 == 0 && q != p);
+    BumpArena::Mark m = a.mark();
+    size_t used = a.used();
+    a.alloc(100);
+    a.rewind(m);
+    CHECK(a.used() == used);
+    {
+        ArenaScope scope(a);
+        a.alloc(2000);                  /* a second block */
+        CHECK(a.capacity() > 1024);
+    }
+    CHECK(a.used() == used);
+    a.alloc(2000);
+    size_t total = a.capacity();
+    a.reset();
+    /* one block of the combined size, so the same work needs no more */
+    CHECK(a.used() == 0 && a.capacity() == total);
+    a.alloc(3, 1);
+    a.alloc(8, 64);
+    a.alloc(2000);
+    CHECK(a.capacity() == total);
+    int* ints = a.alloc_array<int>(10);
+    ints[9] = 1;
+
+    /* workers reset their arena between tasks */
+    ThreadPoolOptions o;
+    o.threads = 2;
+    o.arena_bytes = 4096;
+    ThreadPool pool(o);
+    std::atomic<int> dirty(0);
+    TaskGroup group;
+    for (int i = 0; i < 500; i++) {
+        pool.post(group, [&dirty]{
+            BumpArena& s = ThreadPool::scratch();
+            dirty += s.used() != 0;
+            memset(s.alloc(1000), 0, 1000);
+        });
+    }
+    group.wait();
+    CHECK(dirty == 0);
+    /* parallel_for rewinds after every chunk, on the caller as well */
+    BumpArena& mine = ThreadPool::scratch();
+    size_t before = mine.used();
+    parallel_for(pool, 0, 100, 1, [](size_t) { ThreadPool::scratch().alloc(512); });
+    CHECK(mine.used() == before);
+}
+
+static void check_parallel() {
+    ThreadPool pool(6);
+    std::vector<std::atomic<int>> hit(10007);
+    parallel_for(pool, 0, hit.size(), 64, [&hit](size_t i) { hit[i]++; });
+    for (auto& h : hit) {
+        CHECK(h == 1);
+    }
+    parallel_for(pool, 5, 5, 1, [](size_t) { CHECK(false); });
+
+    long sum = parallel_reduce(pool, 0, 100000, 1000, 0L,
+                               [](size_t i) { return (long)i; },
+                               [](long a, long b) { return a + b; });
+    CHECK(sum == 100000L * 99999 / 2);
+    /* chunks are combined in index order, so a non-commutative fold works */
+    std::string digits = parallel_reduce(pool, 0, 500, 7, std::string(),
+        [](size_t i) { return std::string(1, char('0' + i % 10)); },
+        [](std::string a, const std::string& b) { return a + b; });
+    CHECK(digits.size() == 500);
+    for (size_t i = 0; i < 500; i++) {
+        CHECK(digits[i] == char('0' + i % 10));
+    }
+
+    /* a wide stage reorders, the serial stage after it restores the order */
+    std::vector<int> out;
+    int next = 0;
+    Pipeline<int> p(pool, 4);
+    p.stage(1, [](int& x) { x *= 2; })
+     .stage(4, [](int& x) { x += 1; })
+     .stage(1, [&out](int& x) { out.push_back(x); });
+    p.run([&next](int& x) {
+        if (next == 1000) {
+            return false;
+        }
+        x = next++;
+        return true;
+    });
+    CHECK(out.size() == 1000);
+    for (int i = 0; i < 1000; i++) {
+        CHECK(out[i] == 2 * i + 1);
+    }
+
+    next = 0;
+    Pipeline<int> bad(pool, 4);
+    bad.stage(2, [](int& x) {
+        if (x == 50) {
+            throw std::runtime_error("stage");
+        }
+    });
+    CHECK(throws<std::runtime_error>([&]{
+        bad.run([&next](int& x) {
+            x = next++;
+            return true;
+        });
+    }));
+
+    /* a slow item holds up the source rather than letting the serial
+     * stage behind the wide one buffer everything after it */
+    std::atomic<int> pulled(0);
+    int pulled_while_slow = 0;
+    out.clear();
+    Pipeline<int> slow(pool, 4);
+    slow.stage(4, [&](int& x) {
+            if (x == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                pulled_while_slow = pulled;
+            }
+        })
+        .stage(1, [&out](int& x) { out.push_back(x); });
+    slow.run([&pulled](int& x) {
+        if (pulled == 1000) {
+            return false;
+        }
+        x = pulled++;
+        return true;
+    });
+    CHECK(pulled_while_slow < 32);
+    CHECK(out.size() == 1000);
+    for (int i = 0; i < 1000; i++) {
+        CHECK(out[i] == i);
+    }
+
+    Pipeline<int> wide(pool, 4);
+    wide.stage(7, [](int&) {});
+    CHECK(throws<std::invalid_argument>([&]{ wide.run([](int&) { return false; }); }));
+    /* run from a pool task, whose worker is taken for the run */
+    auto inside = pool.enqueue([&pool]{
+        Pipeline<int> full(pool, 4);
+        full.stage(6, [](int&) {});
+        bool rejected = throws<std::invalid_argument>([&]{ full.run([](int&) { return false; }); });
+        int n = 0;
+        Pipeline<int> fits(pool, 4);
+        fits.stage(5, [](int&) {});
+        fits.run([&n](int& x) {
+            x = n;
+            return n++ < 100;
+        });
+        return rejected;
+    });
+    CHECK(inside.get());
+}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+static CoTask<int> square(ThreadPool& pool, int x) {
+    co_await schedule_on(pool);
+    int r = co_await run_on(pool, [x]{ return x * x; });
+    co_return r;
+}
+
+static CoTask<int> sum_of_squares(ThreadPool& pool, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += co_await square(pool, i);
+    }
+    co_return sum;
+}
+
+static CoTask<void> fail_on(ThreadPool& pool) {
+    co_await schedule_on(pool);
+    throw std::runtime_error("coroutine");
+}
+
+static CoTask<long> read_sum(ThreadPool& pool, CoIo& io, int fd, size_t len) {
+    std::vector<char> buf(len);
+    ssize_t n = co_await io.read(fd, buf.data(), len, 0);
+    CHECK(n == (ssize_t)len);
+    co_return co_await run_on(pool, [&]{
+        long s = 0;
+        for (char c : buf) {
+            s += (unsigned char)c;
+        }
+        return s;
+    });
+}
+
+static CoTask<void> bump(ThreadPool& pool, std::atomic<int>& count) {
+    co_await schedule_on(pool);
+    count += co_await square(pool, 2);
+}
+
+static void check_coro() {
+    ThreadPool pool(4);
+    CHECK(sync_wait(square(pool, 7)) == 49);
+    CHECK(sync_wait(sum_of_squares(pool, 10)) == 285);
+    CHECK(throws<std::runtime_error>([&]{ sync_wait(fail_on(pool)); }));
+    CHECK(throws<std::runtime_error>([&]{
+        sync_wait([](ThreadPool& p) -> CoTask<int> {
+            co_return co_await run_on(p, []() -> int { throw std::runtime_error("run_on"); });
+        }(pool));
+    }));
+
+    CoIo io(pool, 2);
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/pool_test_%d", (int)getpid());
+    std::vector<char> data(100000);
+    long expect = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (char)(i * 7);
+        expect += (unsigned char)data[i];
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    CHECK(sync_wait([](CoIo& io, int fd, std::vector<char>& d) -> CoTask<ssize_t> {
+        co_return co_await io.write(fd, d.data(), d.size(), 0);
+    }(io, fd, data)) == (ssize_t)data.size());
+    for (int r = 0; r < 20; r++) {
+        CHECK(sync_wait(read_sum(pool, io, fd, data.size())) == expect);
+    }
+    char b[4];
+    CHECK(sync_wait([](CoIo& io, char* b) -> CoTask<ssize_t> {
+        co_return co_await io.read(-1, b, 4, 0);
+    }(io, b)) == -EBADF);
+    close(fd);
+    unlink(path);
+
+    std::atomic<int> count(0);
+    for (int i = 0; i < 500; i++) {
+        spawn(pool, bump(pool, count));
+    }
+    while (count < 2000) {
+        std::this_thread::yield();
+    }
+}
+
+/* I/O that completes while the pool shuts down resumes on the I/O
+ * thread rather than terminating on the pool's refusal. */
+static void check_coro_shutdown() {
+    ThreadPool* pool = new ThreadPool(1);
+    CoIo io(*pool);
+    std::mutex gate;
+    std::unique_lock<std::mutex> closed(gate);
+    pool->post([&gate]{ std::lock_guard<std::mutex> wait(gate); });
+    std::thread stopper([pool]{ delete pool; });
+    /* the destructor is waiting on the blocked worker once posts fail */
+    for (;;) {
+        try {
+            pool->post([]{});
+        } catch (const std::runtime_error&) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+
+    int fd = open("/dev/zero", O_RDONLY);
+    CHECK(fd >= 0);
+    char buf[16] = {1};
+    std::atomic<ssize_t> got(-1);
+    [](CoIo& io, int fd, char* buf, std::atomic<ssize_t>& got) -> CoDetached {
+        got = co_await io.read(fd, buf, 16, 0);
+    }(io, fd, buf, got);
+    while (got < 0) {
+        std::this_thread::yield();
+    }
+    CHECK(got == 16 && buf[0] == 0);
+    close(fd);
+
+    closed.unlock();
+    stopper.join();
+}
+#endif
+
+int main() {
+    check_deque();
+    check_ring();
+    check_task_node();
+    check_arena();
+    check_parallel();
+    check_bounded_bulk();
+    check_bounded_deque();
+    check_lanes();
+    check_sampling();
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+    check_coro();
+    check_coro_shutdown();
+#endif
+    printf("components ok\n");
+
+    for (const Mode& mode : modes()) {
+        check_order(mode);
+        check_nesting(mode);
+        check_exceptions(mode);
+        check_shutdown(mode);
+        printf("%s ok\n", mode.name);
+    }
+    return 0;
+}
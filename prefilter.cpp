@@ -0,0 +1,114 @@
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "prefilter.h"
+#include "md5.h"
+#include "cdc.h"
+
+using std::string;
+
+WeakPrefilter::WeakPrefilter(size_t workers)
+    : n_chunks(0), n_weak_hits(0), n_dup_chunks(0), n_dup_bytes(0),
+      pool(workers) {
+}
+
+Fingerprint128 WeakPrefilter::strong(const char* block, uint32_t len) {
+    MD5 m(reinterpret_cast<const byte*>(block), len);
+    return m.getFingerprint();
+}
+
+void WeakPrefilter::store(const Fingerprint128& digest, int fd_chunk, off_t md5_pos) {
+    if (fd_chunk < 0) {
+        return;
+    }
+    if (pwrite(fd_chunk, digest.data(), digest.size, md5_pos) != (ssize_t)digest.size) {
+        throw std::runtime_error("prefilter: md5 write back failed");
+    }
+}
+
+bool WeakPrefilter::check(const char* block, uint32_t len, uint32_t weak,
+                          int fd_chunk, off_t md5_pos) {
+    n_chunks++;
+    auto& candidates = index[(static_cast<uint64_t>(weak) << 32) | len];
+
+    if (candidates.empty()) {
+        /* new chunk for sure, hash it for storage in the background */
+        string copy(block, len);
+        auto digest = pool.enqueue([copy, fd_chunk, md5_pos]() {
+            Fingerprint128 d = strong(copy.data(), copy.size());
+            store(d, fd_chunk, md5_pos);
+            return d;
+        }).share();
+        candidates.push_back(digest);
+        pending.push_back(digest);
+        return false;
+    }
+
+    n_weak_hits++;
+    Fingerprint128 digest = strong(block, len);
+    store(digest, fd_chunk, md5_pos);
+    for (auto& c : candidates) {
+        if (c.get() == digest) {
+            n_dup_chunks++;
+            n_dup_bytes += len;
+            return true;
+        }
+    }
+    std::promise<Fingerprint128> ready;
+    ready.set_value(digest);
+    candidates.push_back(ready.get_future().share());
+    return false;
+}
+
+void WeakPrefilter::drain() {
+    auto done = std::move(pending);
+    pending.clear();
+    for (auto& p : done) {
+        p.get();
+    }
+}
+
+/* C bridge for cdc.c */
+
+struct _weak_filter {
+    explicit _weak_filter(size_t workers) : filter(workers) {}
+    WeakPrefilter filter;
+};
+
+extern "C" {
+
+weak_filter *weak_filter_create(size_t workers) {
+    return new weak_filter(workers);
+}
+
+int weak_filter_check(weak_filter *wf, const char *block, uint32_t len,
+                      uint32_t weak, int fd_chunk, off_t md5_pos) {
+    try {
+        return wf->filter.check(block, len, weak, fd_chunk, md5_pos) ? 1 : 0;
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+int weak_filter_drain(weak_filter *wf) {
+    try {
+        wf->filter.drain();
+        return 0;
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+void weak_filter_stats(const weak_filter *wf, weak_filter_stats_t *stats) {
+    stats->chunks = wf->filter.chunks();
+    stats->weak_hits = wf->filter.weak_hits();
+    stats->dup_chunks = wf->filter.dup_chunks();
+    stats->dup_bytes = wf->filter.dup_bytes();
+}
+
+void weak_filter_destroy(weak_filter *wf) {
+    delete wf;
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <cstdint>
+#include <future>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#include "fingerprint.h"
+#include "threadpool.h"
+
+/*
+ * Dedup index keyed by (weak checksum, length) in front of the MD5 index.
+ *
+ * A weak miss already proves the chunk is new, so its MD5 is only needed
+ * to store it and is computed on the pool off the lookup path.  A weak
+ * hit computes the MD5 inline and compares it with every stored chunk
+ * sharing the weak key, waiting for any of them still being hashed.
+ *
+ * check() and drain() must be called from a single thread.
+ */
+class WeakPrefilter {
+public:
+    explicit WeakPrefilter(size_t workers);
+
+    /* Look a chunk up, returns true if an identical chunk was seen before.
+     * Its MD5 is written to fd_chunk at md5_pos (skipped if fd_chunk < 0),
+     * possibly after check() returns. */
+    bool check(const char* block, uint32_t len, uint32_t weak,
+               int fd_chunk, off_t md5_pos);
+
+    /* Wait until every lazily computed MD5 has been stored and written,
+     * rethrows the first background failure. */
+    void drain();
+
+    uint64_t chunks() const { return n_chunks; }
+    uint64_t weak_hits() const { return n_weak_hits; }
+    uint64_t dup_chunks() const { return n_dup_chunks; }
+    uint64_t dup_bytes() const { return n_dup_bytes; }
+
+private:
+    static Fingerprint128 strong(const char* block, uint32_t len);
+    static void store(const Fingerprint128& digest, int fd_chunk, off_t md5_pos);
+
+    std::unordered_map<uint64_t, std::vector<std::shared_future<Fingerprint128>>> index;
+    std::vector<std::shared_future<Fingerprint128>> pending;
+
+    uint64_t n_chunks;
+    uint64_t n_weak_hits;
+    uint64_t n_dup_chunks;
+    uint64_t n_dup_bytes;
+
+    ThreadPool pool;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cmath>
+
+#include "sample.h"
+#include "md5.h"
+#include "cdc.h"
+
+void DedupSampler::add(const char* block, uint32_t len, uint32_t weak) {
+    chunks++;
+    bytes += len;
+    if (!selected(weak)) {
+        return;
+    }
+
+    MD5 m(reinterpret_cast<const byte*>(block), len);
+    double x = len;
+    double y = seen.insert(m.getFingerprint()).second ? 0 : x;
+    sampled++;
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+    sum_yy += y * y;
+}
+
+DedupEstimate DedupSampler::estimate() const {
+    DedupEstimate e;
+    e.chunks = chunks;
+    e.bytes = bytes;
+    e.sampled_chunks = sampled;
+    e.sampled_bytes = static_cast<uint64_t>(sum_x);
+    e.ratio = sum_x > 0 ? sum_y / sum_x : 0;
+    e.error = 1;
+    if (sampled > 1) {
+        /* var(R) ~ sum((y - R x)^2) / ((n - 1) n mean(x)^2) */
+        double n = static_cast<double>(sampled);
+        double mean_x = sum_x / n;
+        double resid = sum_yy - 2 * e.ratio * sum_xy + e.ratio * e.ratio * sum_xx;
+        double var = resid > 0 ? resid / ((n - 1) * n * mean_x * mean_x) : 0;
+        /* a fully unique or fully duplicate sample still leaves the
+         * unseen chunks uncertain, never claim better than 1/n */
+        e.error = std::max(1.96 * std::sqrt(var), 1 / n);
+    }
+    return e;
+}
+
+/* C bridge for cdc.c */
+
+extern "C" {
+
+dedup_sampler *dedup_sampler_create(int bits) {
+    if (bits < 0 || bits > 32) {
+        return nullptr;
+    }
+    return new dedup_sampler(bits);
+}
+
+void dedup_sampler_add(dedup_sampler *ds, const char *block, uint32_t len, uint32_t weak) {
+    std::lock_guard<std::mutex> guard(ds->lock);
+    ds->sampler.add(block, len, weak);
+}
+
+void dedup_sampler_destroy(dedup_sampler *ds) {
+    delete ds;
+}
+
+}
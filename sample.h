@@ -0,0 +1,65 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+
+#include "fingerprint.h"
+
+/* Dedup ratio predicted from a sample, with a 95% confidence interval. */
+struct DedupEstimate {
+    uint64_t chunks;            /* all chunks seen */
+    uint64_t bytes;
+    uint64_t sampled_chunks;
+    uint64_t sampled_bytes;
+    double ratio;               /* estimated fraction of duplicate bytes */
+    double error;               /* half width of the 95% interval */
+};
+
+/*
+ * Content-defined sampling for dedup estimation.
+ *
+ * A chunk is sampled when the top `bits` bits of its mixed weak checksum
+ * are zero, so the same content is always sampled or always skipped,
+ * whichever file it is in.  Only sampled chunks are fingerprinted, and
+ * the duplicate byte ratio among them estimates the ratio of the whole
+ * dataset (a ratio estimator over chunks, hence the error bound).
+ */
+class DedupSampler {
+public:
+    /* bits is clamped to 0..32; 0 samples every chunk */
+    explicit DedupSampler(int bits) : bits(std::min(std::max(bits, 0), 32)), chunks(0), bytes(0),
+        sampled(0), sum_x(0), sum_y(0), sum_xx(0), sum_xy(0), sum_yy(0) {}
+
+    bool selected(uint32_t weak) const {
+        uint32_t mixed = weak * 0x9e3779b1u;
+        return bits == 0 || (mixed >> (32 - bits)) == 0;
+    }
+
+    /* Count a chunk, fingerprinting it if it falls in the sample. */
+    void add(const char* block, uint32_t len, uint32_t weak);
+
+    DedupEstimate estimate() const;
+
+private:
+    int bits;
+    std::unordered_set<Fingerprint128> seen;
+
+    uint64_t chunks;
+    uint64_t bytes;
+    uint64_t sampled;
+    /* x = chunk length, y = duplicate bytes in it (0 or x) */
+    double sum_x, sum_y, sum_xx, sum_xy, sum_yy;
+};
+
+/* The handle behind chunk_ctx.ds.  Files may be chunked on several
+ * threads into one sampler, so dedup_sampler_add() takes the lock. */
+struct _dedup_sampler {
+    explicit _dedup_sampler(int bits) : sampler(bits) {}
+    std::mutex lock;
+    DedupSampler sampler;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include <array>
+
+#include "sketch.h"
+#include "cdc.h"
+
+namespace {
+
+/* evaluate the transforms at 1/16 of the positions */
+const uint64_t SAMPLE_MASK = 0xf000000000000000ULL;
+
+constexpr uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+template <size_t N>
+constexpr std::array<uint64_t, N> random_table(uint64_t seed, uint64_t or_mask) {
+    std::array<uint64_t, N> t{};
+    for (size_t i = 0; i < N; i++) {
+        t[i] = splitmix64(seed) | or_mask;
+    }
+    return t;
+}
+
+constexpr auto gear = random_table<256>(0x6d61736b, 0);
+constexpr auto mul = random_table<SKETCH_FEATURES>(0x66656174, 1);    /* odd */
+constexpr auto add = random_table<SKETCH_FEATURES>(0x75726573, 0);
+
+}
+
+Sketch Sketch::of(const char* block, uint32_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(block);
+    uint64_t feature[SKETCH_FEATURES] = {0};
+    uint64_t h = 0;
+    uint32_t samples = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        h = (h << 1) + gear[p[i]];
+        if ((h & SAMPLE_MASK) == 0) {
+            samples++;
+            for (int k = 0; k < SKETCH_FEATURES; k++) {
+                uint64_t v = mul[k] * h + add[k];
+                feature[k] = v > feature[k] ? v : feature[k];
+            }
+        }
+    }
+
+    Sketch s;
+    s.samples = samples;
+    const int per = SKETCH_FEATURES / SKETCH_SUPER;
+    for (int j = 0; j < SKETCH_SUPER; j++) {
+        uint64_t x = j;
+        for (int k = 0; k < per; k++) {
+            x ^= feature[j * per + k];
+            x = splitmix64(x);
+        }
+        s.sf[j] = x;
+    }
+    return s;
+}
+
+bool SketchIndex::most_similar(const Sketch& sketch, uint64_t& base, int& score) const {
+    if (sketch.empty()) {
+        return false;
+    }
+    uint64_t hit[SKETCH_SUPER];
+    int n = 0;
+    for (int j = 0; j < SKETCH_SUPER; j++) {
+        auto it = table[j].find(sketch.sf[j]);
+        if (it != table[j].end()) {
+            hit[n++] = it->second;
+        }
+    }
+    if (n == 0) {
+        return false;
+    }
+
+    /* most votes wins, the newer chunk on a tie */
+    score = 0;
+    for (int i = 0; i < n; i++) {
+        int votes = 0;
+        for (int k = 0; k < n; k++) {
+            votes += hit[k] == hit[i];
+        }
+        if (votes > score || (votes == score && hit[i] > base)) {
+            base = hit[i];
+            score = votes;
+        }
+    }
+    return true;
+}
+
+void SketchIndex::insert(const Sketch& sketch, uint64_t id) {
+    if (sketch.empty()) {
+        return;
+    }
+    for (int j = 0; j < SKETCH_SUPER; j++) {
+        table[j][sketch.sf[j]] = id;
+    }
+    stored++;
+}
+
+bool SketchIndex::add(const Sketch& sketch, uint64_t id, DeltaCandidate& found) {
+    uint64_t base = 0;
+    int score = 0;
+    bool similar = most_similar(sketch, base, score);
+    insert(sketch, id);
+    if (similar) {
+        found = DeltaCandidate{id, base, score};
+    }
+    return similar;
+}
+
+/* C bridge for cdc.c */
+
+struct _sketch_index {
+    SketchIndex index;
+};
+
+extern "C" {
+
+sketch_index *sketch_index_create(void) {
+    return new sketch_index();
+}
+
+int64_t sketch_index_add(sketch_index *sk, uint64_t id, const char *block, uint32_t len) {
+    DeltaCandidate found;
+    if (!sk->index.add(Sketch::of(block, len), id, found)) {
+        return -1;
+    }
+    return static_cast<int64_t>(found.base);
+}
+
+void sketch_index_destroy(sketch_index *sk) {
+    delete sk;
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <cstdint>
+#include <unordered_map>
+
+/* N-transform resemblance sketch: SKETCH_FEATURES features grouped into
+ * SKETCH_SUPER super-features of SKETCH_FEATURES / SKETCH_SUPER each. */
+#define SKETCH_FEATURES 12
+#define SKETCH_SUPER 3
+
+/*
+ * Similarity sketch of one chunk.
+ *
+ * A gear rolling hash runs over the chunk and at sampled positions each
+ * of N linear transforms of the hash keeps its maximum.  Chunks that
+ * differ by a few bytes keep most maxima, and grouping the features into
+ * super-features means a single matching super-feature is already a
+ * strong resemblance hint.
+ */
+struct Sketch {
+    uint64_t sf[SKETCH_SUPER];
+    uint32_t samples;   /* sampled positions; with none every feature is 0 */
+
+    bool empty() const { return samples == 0; }
+
+    static Sketch of(const char* block, uint32_t len);
+};
+
+/* A chunk and the stored chunk it most resembles. */
+struct DeltaCandidate {
+    uint64_t id;
+    uint64_t base;
+    int score;      /* matching super-features, 1..SKETCH_SUPER */
+};
+
+/*
+ * Super-feature index for delta-compression candidate search.
+ *
+ * Chunks are stored under ids the caller picks, so they can line up with
+ * the block entries.  Each super-feature value remembers the newest chunk
+ * that had it, and a lookup votes across the SKETCH_SUPER tables for the
+ * most similar stored chunk.  Empty sketches are never stored or matched:
+ * all chunks too short to sample would otherwise look alike.
+ */
+class SketchIndex {
+public:
+    SketchIndex() : stored(0) {}
+
+    /* Most similar stored chunk, false if no super-feature matches. */
+    bool most_similar(const Sketch& sketch, uint64_t& base, int& score) const;
+
+    /* Store a chunk's sketch under id, newer ids replacing older ones. */
+    void insert(const Sketch& sketch, uint64_t id);
+
+    /* Look up, then store; true with found filled in if a base matched. */
+    bool add(const Sketch& sketch, uint64_t id, DeltaCandidate& found);
+
+    uint64_t size() const { return stored; }
+
+private:
+    std::unordered_map<uint64_t, uint64_t> table[SKETCH_SUPER];
+    uint64_t stored;
+};
+
+#endif
@@ -1,82 +1,283 @@
 #include "get_file_list.h"
+#include <mutex>
 //#define linux
 //#define _WIN32
- 
+
 using namespace std;
 
- 
-#ifdef linux
+
+#if defined(linux) || defined(__linux__)
 #include <memory.h>
 #include <dirent.h>
-vector<string> getFilesList(string dirpath) {
-	vector<string> allPath;
-	DIR *dir = opendir(dirpath.c_str());
-	if (dir == NULL)
-	{
-		cout << "opendir error" << endl;
-		return allPath;
-	}
-	struct dirent *entry;
-	while ((entry = readdir(dir)) != NULL)
-	{
-		if (entry->d_type == DT_DIR) {//It's dir
-			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include "../threadpool.h"
+
+/* What getdents64 fills its buffer with. */
+struct Dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+/* Enough for a few thousand entries per system call. */
+static const size_t DENTS_BYTES = 256 << 10;
+static const int DIR_FLAGS = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+struct DirFd {
+	explicit DirFd(int fd) : fd(fd) {}
+	~DirFd() { if (fd >= 0) close(fd); }
+	int fd;
+};
+
+/* Say which directory could not be opened or read, and why; one write,
+ * so parallel walkers do not interleave. */
+static void dirError(const char* what, const string& path) {
+	int err = errno;
+	cout << string(what) + " error " + path + ": " + strerror(err) + "\n" << flush;
+}
+
+/* Type of an entry the file system left as DT_UNKNOWN. */
+static unsigned char statType(int dirfd, const char* name) {
+	struct stat st;
+	if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		return DT_UNKNOWN;
+	return IFTODT(st.st_mode);
+}
+
+/* Read all of the open directory fd.  Files go to fn at once, subdirectory
+ * names are returned so the caller descends after buf is free again.
+ * Stops early once stop is set.  Every call has its own path buffer, so a
+ * walk started from inside fn cannot overwrite the path fn was given. */
+static void listDir(int fd, const string& dir, char* buf, const function<void(const FileEntry&)>& fn,
+		vector<string>& subdirs, const atomic<bool>* stop = NULL) {
+	string path(dir);
+	path += '/';
+	for (;;) {
+		long n = syscall(SYS_getdents64, fd, buf, DENTS_BYTES);
+		if (n < 0)
+			dirError("readdir", dir);
+		if (n <= 0)
+			return;
+		for (long pos = 0; pos < n;) {
+			if (stop && *stop)
+				return;
+			Dirent64* d = reinterpret_cast<Dirent64*>(buf + pos);
+			const char* name = buf + pos + offsetof(Dirent64, d_name);
+			pos += d->d_reclen;
+			if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
 				continue;
-			string dirNew = dirpath + "/" + entry->d_name;
-			vector<string> tempPath = getFilesList(dirNew);
-			allPath.insert(allPath.end(), tempPath.begin(), tempPath.end());
- 
+			unsigned char type = d->d_type;
+			if (type == DT_UNKNOWN)
+				type = statType(fd, name);
+			if (type == DT_DIR)
+				subdirs.emplace_back(name);
+			else
+				fn(FileEntry{fd, name, type, dir, path});
+		}
+	}
+}
+
+/* Depth first.  One buffer serves every level, and each level keeps only
+ * its directory fd open while below it. */
+static void walk(int fd, const string& dir, char* buf, const function<void(const FileEntry&)>& fn) {
+	DirFd guard(fd);
+	vector<string> subdirs;
+	listDir(fd, dir, buf, fn, subdirs);
+	for (auto& name : subdirs) {
+		int sub = openat(fd, name.c_str(), DIR_FLAGS | O_NOFOLLOW);
+		if (sub < 0) {
+			dirError("opendir", dir + "/" + name);
+			continue;
 		}
-		else {
-			//cout << "name = " << entry->d_name << ", len = " << entry->d_reclen << ", entry->d_type = " << (int)entry->d_type << endl;
-			string name = entry->d_name;
-			string imgdir = dirpath + "/" + name;
-			//sprintf("%s",imgdir.c_str());
-			allPath.push_back(imgdir);
+		walk(sub, dir + "/" + name, buf, fn);
+	}
+}
+
+void forEachEntry(const string& dirpath, const function<void(const FileEntry&)>& fn) {
+	int fd = open(dirpath.c_str(), DIR_FLAGS);
+	if (fd < 0) {
+		dirError("opendir", dirpath);
+		return;
+	}
+	vector<char> buf(DENTS_BYTES);
+	walk(fd, dirpath, buf.data(), fn);
+}
+
+/* An open directory and its path, shared by the tasks of its
+ * subdirectories until each has opened its own. */
+struct OpenDir {
+	OpenDir(int fd, string path) : fd(fd), path(std::move(path)) {}
+	DirFd fd;
+	string path;
+};
+
+/* One pool task per directory.  A task reads its directory to the end,
+ * handing files to fn, then posts a task per subdirectory that opens it
+ * relative to this one.  The getdents buffer comes from the worker's
+ * scratch arena.  The first exception from fn stops the walk and is
+ * rethrown by run(). */
+struct ParallelWalk {
+	ParallelWalk(ThreadPool& pool, const function<void(const FileEntry&)>& fn)
+		: pool(pool), fn(fn), failed(false) {}
+
+	void scan(const shared_ptr<OpenDir>& dir) {
+		vector<string> subdirs;
+		try {
+			char* buf = static_cast<char*>(ThreadPool::scratch().alloc(DENTS_BYTES));
+			listDir(dir->fd.fd, dir->path, buf, fn, subdirs, &failed);
+			for (auto& name : subdirs) {
+				pool.post(group, [this, dir, name = std::move(name)]() mutable {
+					descend(std::move(dir), name);
+				});
+			}
+		} catch (...) {
+			fail();
 		}
- 
 	}
-	closedir(dir);
-	//system("pause");
-	return allPath;
+
+	void descend(shared_ptr<OpenDir> parent, const string& name) {
+		if (failed)
+			return;
+		int fd = openat(parent->fd.fd, name.c_str(), DIR_FLAGS | O_NOFOLLOW);
+		if (fd < 0) {
+			dirError("opendir", parent->path + "/" + name);
+			return;
+		}
+		shared_ptr<OpenDir> dir;
+		try {
+			dir = make_shared<OpenDir>(fd, parent->path + "/" + name);
+		} catch (...) {
+			close(fd);
+			fail();
+			return;
+		}
+		/* the last child to get here closes the parent */
+		parent.reset();
+		scan(dir);
+	}
+
+	void fail() {
+		lock_guard<mutex> lock(m);
+		if (!failed.exchange(true))
+			error = current_exception();
+	}
+
+	void run(const string& dirpath) {
+		int fd = open(dirpath.c_str(), DIR_FLAGS);
+		if (fd < 0) {
+			dirError("opendir", dirpath);
+			return;
+		}
+		auto root = make_shared<OpenDir>(fd, dirpath);
+		pool.post(group, [this, root]{ scan(root); });
+		group.wait();
+		if (error)
+			rethrow_exception(error);
+	}
+
+	ThreadPool& pool;
+	const function<void(const FileEntry&)>& fn;
+	TaskGroup group;
+	mutex m;
+	atomic<bool> failed;
+	exception_ptr error;
+};
+
+void forEachEntry(const string& dirpath, size_t threads, const function<void(const FileEntry&)>& fn) {
+	if (threads <= 1) {
+		forEachEntry(dirpath, fn);
+		return;
+	}
+	ThreadPoolOptions options;
+	options.threads = threads;
+	options.work_stealing = true;	/* subdirectories stay with the worker that found them */
+	options.arena_bytes = DENTS_BYTES + 4096;
+	ThreadPool pool(options);
+	ParallelWalk(pool, fn).run(dirpath);
+}
+
+void forEachFile(const string& dirpath, const function<void(const string&)>& fn) {
+	forEachFile(dirpath, 1, fn);
+}
+
+void forEachFile(const string& dirpath, size_t threads, const function<void(const string&)>& fn) {
+	forEachEntry(dirpath, threads, [&fn](const FileEntry& e) {
+		fn(e.path());
+	});
 }
 #endif
- 
+
 #ifdef _WIN32//__WINDOWS_
-#include <io.h>  
-vector<string> getFilesList(string dir)
+#include <io.h>
+void forEachFile(const string& dir, const function<void(const string&)>& fn)
 {
-	vector<string> allPath;
 	// 在目录后面加上"\\*.*"进行第一次搜索
 	string dir2 = dir + "\\*.*";
- 
+
 	intptr_t handle;
 	_finddata_t findData;
- 
+
 	handle = _findfirst(dir2.c_str(), &findData);
 	if (handle == -1) {// 检查是否成功
 		cout << "can not found the file ... " << endl;
-		return allPath;
+		return;
 	}
-	while (_findnext(handle, &findData) == 0)
-	{
-		if (findData.attrib & _A_SUBDIR)//// 是否含有子目录
+	try {
+		while (_findnext(handle, &findData) == 0)
 		{
-			//若该子目录为"."或".."，则进行下一次循环，否则输出子目录名，并进入下一次搜索
-			if (strcmp(findData.name, ".") == 0 || strcmp(findData.name, "..") == 0)
-				continue;
-			// 在目录后面加上"\\"和搜索到的目录名进行下一次搜索
-			string dirNew = dir + "\\" + findData.name;
-			vector<string> tempPath = getFilesList(dirNew);
-			allPath.insert(allPath.end(), tempPath.begin(), tempPath.end());
-		}
-		else //不是子目录，即是文件，则输出文件名和文件的大小
-		{
-			string filePath = dir + "\\" + findData.name;
-			allPath.push_back(filePath);
+			if (findData.attrib & _A_SUBDIR)//// 是否含有子目录
+			{
+				//若该子目录为"."或".."，则进行下一次循环，否则输出子目录名，并进入下一次搜索
+				if (strcmp(findData.name, ".") == 0 || strcmp(findData.name, "..") == 0)
+					continue;
+				// 在目录后面加上"\\"和搜索到的目录名进行下一次搜索
+				string dirNew = dir + "\\" + findData.name;
+				forEachFile(dirNew, fn);
+			}
+			else //不是子目录，即是文件，则输出文件名和文件的大小
+			{
+				string filePath = dir + "\\" + findData.name;
+				fn(filePath);
+			}
 		}
+	} catch (...) {
+		_findclose(handle);
+		throw;
 	}
 	_findclose(handle);    // 关闭搜索句柄
-	return allPath;
+}
+
+void forEachFile(const string& dir, size_t threads, const function<void(const string&)>& fn)
+{
+	(void)threads;
+	forEachFile(dir, fn);
 }
 #endif
+
+vector<string> getFilesList(string dir) {
+	vector<string> allPath;
+	forEachFile(dir, [&allPath](const string& path) { allPath.push_back(path); });
+	return allPath;
+}
+
+vector<string> getFilesList(string dir, size_t threads) {
+	vector<string> allPath;
+	mutex m;
+	forEachFile(dir, threads, [&allPath, &m](const string& path) {
+		lock_guard<mutex> lock(m);
+		allPath.push_back(path);
+	});
+	return allPath;
+}
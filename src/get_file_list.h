@@ -1,11 +1,47 @@
 #ifndef GET_FILE_LIST_H
 #define GET_FILE_LIST_H
+#include <functional>
 #include <iostream>
-#include <string>  
+#include <string>
 #include <vector>
 
 using namespace std;
 
+/* Call fn on every file under dir as it is found, without collecting the
+ * paths first.  The string passed to fn is only valid during the call. */
+void forEachFile(const string& dir, const function<void(const string&)>& fn);
+/* Same, with up to threads directories read at once (Linux only).  fn
+ * runs concurrently on the walker threads and must be thread safe; the
+ * order differs from run to run. */
+void forEachFile(const string& dir, size_t threads, const function<void(const string&)>& fn);
+
+#if defined(linux) || defined(__linux__)
+/* A file found by forEachEntry.  dirfd is open during the callback, so
+ * openat(dirfd, name, ...) reaches the file without resolving the full
+ * path again; path() builds that path only when asked, in a buffer the
+ * walk keeps for the directory being read, and it is only valid during
+ * the callback. */
+struct FileEntry {
+	int dirfd;
+	const char* name;
+	unsigned char type;     /* DT_REG, DT_LNK, ...; never DT_DIR */
+	const string& dir;
+	string& buf;            /* holds dir + "/" */
+
+	const string& path() const {
+		buf.resize(dir.size() + 1);
+		return buf.append(name);
+	}
+};
+
+/* The walk under forEachFile: directories are opened relative to their
+ * parent and read with large getdents64 calls, and d_type decides what to
+ * descend into without a stat unless the file system leaves it unknown. */
+void forEachEntry(const string& dir, const function<void(const FileEntry&)>& fn);
+void forEachEntry(const string& dir, size_t threads, const function<void(const FileEntry&)>& fn);
+#endif
+
 vector<string> getFilesList(string dir);
+vector<string> getFilesList(string dir, size_t threads);
 
 #endif
\ No newline at end of file
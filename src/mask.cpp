@@ -1,17 +1,78 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 #include "parsecmd.hpp"
 #include "get_file_list.h"
+#include "../cdc.h"
+#include "../sample.h"
 
 using namespace std;
 
+/* Chunk every file but fingerprint only a sample, and predict the dedup ratio.
+ * Files are chunked as the walk finds them, on every walker thread at once;
+ * only the sampler update is serialised. */
+int estimate(const string& dir, int jobs, int bits) {
+    dedup_sampler* ds = dedup_sampler_create(bits);
+    if (!ds) {
+        cout << "sample bits must be 0..32" << endl;
+        return 1;
+    }
+    /* NULL, or what went wrong */
+    auto sample = [ds](int fd) -> const char* {
+        if (fd == -1) {
+            return "open error ";
+        }
+        chunk_ctx ctx = {};
+        ctx.ds = ds;
+        chunk_file_header hdr = {0, 0};
+        const char* err = file_chunk_cdc(fd, -1, &hdr, &ctx) == -1 ? "chunk error " : NULL;
+        close(fd);
+        return err;
+    };
+    mutex m;
+    auto report = [&m](const char* err, const string& path) {
+        lock_guard<mutex> lock(m);
+        cout << err << path << endl;
+    };
+#if defined(linux) || defined(__linux__)
+    /* open relative to the directory the walk already holds, and build
+     * the path only to report a failure */
+    forEachEntry(dir, jobs, [&](const FileEntry& file) {
+        if (const char* err = sample(openat(file.dirfd, file.name, O_RDONLY))) {
+            report(err, file.path());
+        }
+    });
+#else
+    forEachFile(dir, jobs, [&](const string& path) {
+        if (const char* err = sample(open(path.c_str(), O_RDONLY))) {
+            report(err, path);
+        }
+    });
+#endif
+
+    DedupEstimate e = ds->sampler.estimate();
+    cout << "dedup ratio " << e.ratio << " +- " << e.error
+         << " (sampled " << e.sampled_chunks << "/" << e.chunks << " chunks, "
+         << e.sampled_bytes << "/" << e.bytes << " bytes)" << endl;
+    dedup_sampler_destroy(ds);
+    return 0;
+}
+
 
 int main(int argc, char* argv[]) {
     util::Options options("mask", "a new CDC way for duplicated data");
     options.add_options()
     ("d,debug", "enable debugging")
     ("f,filename", "filename of input", util::value<std::string>())
+    ("e,estimate", "estimate the dedup ratio from a sample of chunks")
+    ("b,sample-bits", "fingerprint 1/2^n of the chunks when estimating",
+        util::value<int>()->default_value("6"))
+    ("j,jobs", "directories scanned in parallel",
+        util::value<int>()->default_value("1"))
     ;
     auto result = options.parse(argc, argv);
     bool debug = false;
@@ -25,12 +86,18 @@ int main(int argc, char* argv[]) {
 
     string dir = result["f"].as<std::string>();
 
-    vector<string> files = getFilesList(dir);
+    int jobs = max(result["j"].as<int>(), 1);
 
-    for (auto file : files) {
-        cout << file << endl;
+    if (result.count("e") > 0) {
+        return estimate(dir, jobs, result["b"].as<int>());
     }
 
+    mutex m;
+    forEachFile(dir, jobs, [&m](const string& file) {
+        lock_guard<mutex> lock(m);
+        cout << file << endl;
+    });
+
     // string s;
 
     // for (auto file : path) {
@@ -2,6 +2,8 @@
 #define PARSECMD_HPP
 
 #include <string>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <exception>
 #include <regex>
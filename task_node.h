@@ -0,0 +1,180 @@
+#ifndef TASK_NODE_H
+#define TASK_NODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * One queued task.  Callables up to INLINE bytes are constructed in place,
+ * larger ones fall back to the heap.  next links the node into the pool's
+ * injector list or into a free list, never both at once.
+ */
+struct TaskNode {
+    static constexpr size_t INLINE = 40;
+
+    /* storage first: with the three words after it the node is 64 bytes */
+    alignas(std::max_align_t) unsigned char storage[INLINE];
+    /* run (or just destroy, when run is false) the stored callable */
+    void (*call)(TaskNode*, bool run);
+    TaskNode* next;
+    uint64_t stamp;     /* submit time in ns if metrics or an elastic pool want it, else 0;
+                         * the low bit set means sampled for metrics */
+
+    template <class F>
+    void set(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        if constexpr (sizeof(Fn) <= INLINE && alignof(Fn) <= alignof(std::max_align_t)) {
+            new (storage) Fn(std::forward<F>(f));
+            call = &call_inline<Fn>;
+        } else {
+            new (storage) Fn*(new Fn(std::forward<F>(f)));
+            call = &call_heap<Fn>;
+        }
+        next = nullptr;
+        stamp = 0;
+    }
+
+    void run() { call(this, true); }
+    void discard() { call(this, false); }
+
+private:
+    template <class Fn>
+    static void call_inline(TaskNode* t, bool run) {
+        Fn* fn = std::launder(reinterpret_cast<Fn*>(t->storage));
+        struct Destroy {
+            Fn* fn;
+            ~Destroy() { fn->~Fn(); }
+        } destroy{fn};
+        if (run) {
+            (*fn)();
+        }
+    }
+
+    template <class Fn>
+    static void call_heap(TaskNode* t, bool run) {
+        Fn* fn = *std::launder(reinterpret_cast<Fn**>(t->storage));
+        struct Destroy {
+            Fn* fn;
+            ~Destroy() { delete fn; }
+        } destroy{fn};
+        if (run) {
+            (*fn)();
+        }
+    }
+};
+
+/*
+ * Free list of task nodes shared by every pool.
+ *
+ * Each thread keeps a private cache, so get() and put() normally touch no
+ * lock.  Workers free the nodes that submitters allocated; once a cache
+ * holds 2*BATCH nodes it hands BATCH of them to the shared depot, where a
+ * submitter with an empty cache picks them up, one lock per BATCH nodes.
+ * The depot keeps at most DEPOT_CHAINS batches and frees what comes in
+ * beyond that, so a burst does not pin its peak node count for good.
+ */
+class TaskNodePool {
+public:
+    static constexpr size_t BATCH = 64;
+    static constexpr size_t DEPOT_CHAINS = 64;
+
+    static TaskNode* get() {
+        Cache& c = cache();
+        if (!c.head) {
+            c.count = depot().take(c.head);
+            if (!c.head) {
+                return new TaskNode;
+            }
+        }
+        TaskNode* t = c.head;
+        c.head = t->next;
+        c.count--;
+        return t;
+    }
+
+    static void put(TaskNode* t) {
+        Cache& c = cache();
+        t->next = c.head;
+        c.head = t;
+        if (++c.count >= 2 * BATCH) {
+            TaskNode* chain = c.head;
+            TaskNode* last = chain;
+            for (size_t i = 1; i < BATCH; i++) {
+                last = last->next;
+            }
+            c.head = last->next;
+            last->next = nullptr;
+            c.count -= BATCH;
+            depot().give(chain, BATCH);
+        }
+    }
+
+private:
+    struct Depot {
+        ~Depot() {
+            for (auto& chain : chains) {
+                free_chain(chain.first);
+            }
+        }
+        size_t take(TaskNode*& head) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (chains.empty()) {
+                head = nullptr;
+                return 0;
+            }
+            head = chains.back().first;
+            size_t n = chains.back().second;
+            chains.pop_back();
+            return n;
+        }
+        void give(TaskNode* head, size_t n) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (chains.size() < DEPOT_CHAINS) {
+                    chains.emplace_back(head, n);
+                    return;
+                }
+            }
+            free_chain(head);
+        }
+
+        std::mutex mutex;
+        std::vector<std::pair<TaskNode*, size_t>> chains;
+    };
+
+    /* thread exit returns the cache to the depot */
+    struct Cache {
+        TaskNode* head = nullptr;
+        size_t count = 0;
+        ~Cache() {
+            if (head) {
+                depot().give(head, count);
+            }
+        }
+    };
+
+    static void free_chain(TaskNode* t) {
+        while (t) {
+            TaskNode* next = t->next;
+            delete t;
+            t = next;
+        }
+    }
+
+    static Depot& depot() {
+        static Depot d;
+        return d;
+    }
+
+    static Cache& cache() {
+        thread_local Cache c;
+        return c;
+    }
+};
+
+#endif
@@ -1,51 +1,962 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <future>
 #include <vector>
 #include <thread>
 #include <condition_variable>
-#include <queue>
 #include <functional>
 #include <mutex>
 #include <memory>
 #include <stdexcept>
+#include <iterator>
+#include <type_traits>
+
+#include "arena.h"
+#include "mpmc_ring.h"
+#include "pool_metrics.h"
+#include "task_node.h"
+#include "topology.h"
+#include "work_deque.h"
+
+struct ThreadPoolOptions {
+    size_t threads = std::thread::hardware_concurrency();
+    /* Per-worker Chase-Lev deques: tasks enqueued from inside a task go to
+     * the submitting worker's deque, idle workers steal from random peers.
+     * Tasks from outside the pool still go through the shared queue. */
+    bool work_stealing = false;
+    /* Non-zero replaces the shared queue with a lock-free ring of this many
+     * slots.  Idle workers spin, then yield, before parking, and a full
+     * ring pushes back on the submitter instead of growing. */
+    size_t ring_capacity = 0;
+    /* Pin each worker to one CPU. */
+    bool pin_threads = false;
+    /* Spread workers over the NUMA nodes in contiguous groups, keep each
+     * group on its node's CPUs and give every node its own shared queue,
+     * so post_near() can run a task next to its input buffer. */
+    bool numa_aware = false;
+    /* Non-zero caps the tasks waiting in the shared queue.  Once reached,
+     * enqueue() and post() from outside the pool block, try_enqueue() fails
+     * and try_enqueue_for() waits up to its timeout; a worker runs its own
+     * submission inline instead of waiting.  Tasks a worker pushes to its
+     * own deque are not counted. */
+    size_t max_queued = 0;
+    /* One weight per priority lane of the shared queue; empty means a
+     * single lane.  Non-empty lanes are served by smooth weighted round
+     * robin, so with weights {8, 1} lane 1 still gets one task in every
+     * nine and nothing starves.  Plain submissions go to lane 0. */
+    std::vector<unsigned> lane_weights;
+    /* Keep per-worker counters for metrics().  Queue-wait and run time
+     * are clocked for one task in metrics_sample only. */
+    bool metrics = false;
+    unsigned metrics_sample = 16;
+    /* More than threads makes the pool elastic: a worker is added while
+     * tasks have waited longer than grow_after with nobody idle, and a
+     * worker idle for retire_after exits, down to threads again. */
+    size_t max_threads = 0;
+    std::chrono::milliseconds grow_after{5};
+    std::chrono::milliseconds retire_after{2000};
+    /* Block size of each worker's scratch arena, see scratch(). */
+    size_t arena_bytes = 64 << 10;
+};
+
+/*
+ * State shared by the tasks of one enqueue_bulk() call.  Each task writes
+ * its own result slot; whichever finishes last fulfils the promise, with
+ * the first exception thrown if any task threw.
+ */
+template <class R, class F>
+struct BulkState {
+    static_assert(!std::is_same<R, bool>::value, "vector<bool> slots are not independent");
+    typedef std::vector<R> value_type;
+
+    BulkState(size_t n, F f) : fn(std::move(f)), results(n), remaining(n), failed(false) {}
+
+    template <class T>
+    void run(size_t i, T& item) {
+        try {
+            results[i] = fn(item);
+        } catch (...) {
+            fail();
+        }
+        finish();
+    }
+    void fail() {
+        if (!failed.exchange(true)) {
+            error = std::current_exception();
+        }
+    }
+    void finish() {
+        if (remaining.fetch_sub(1) == 1) {
+            if (error) {
+                done.set_exception(error);
+            } else {
+                done.set_value(std::move(results));
+            }
+        }
+    }
+
+    F fn;
+    std::vector<R> results;
+    std::promise<value_type> done;
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+};
+
+template <class F>
+struct BulkState<void, F> {
+    typedef void value_type;
+
+    BulkState(size_t n, F f) : fn(std::move(f)), remaining(n), failed(false) {}
+
+    template <class T>
+    void run(size_t, T& item) {
+        try {
+            fn(item);
+        } catch (...) {
+            fail();
+        }
+        finish();
+    }
+    void fail() {
+        if (!failed.exchange(true)) {
+            error = std::current_exception();
+        }
+    }
+    void finish() {
+        if (remaining.fetch_sub(1) == 1) {
+            if (error) {
+                done.set_exception(error);
+            } else {
+                done.set_value();
+            }
+        }
+    }
+
+    F fn;
+    std::promise<void> done;
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+};
+
+template <class Iter, class F>
+using BulkStateFor = BulkState<
+    typename std::result_of<F&(typename std::iterator_traits<Iter>::value_type&)>::type, F>;
+
+/*
+ * Completion counter for tasks submitted with post().  Owned by the
+ * caller and reusable once wait() returns, so completion costs no
+ * allocation per task, unlike a future.
+ */
+class TaskGroup {
+public:
+    TaskGroup() : pending(0) {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]{ return pending == 0; });
+    }
+
+private:
+    friend class ThreadPool;
+
+    void add() { pending++; }
+
+    /* The final decrement happens under the mutex, so a waiter cannot
+     * return and destroy the group while we still touch it. */
+    void done() {
+        size_t p = pending.load(std::memory_order_relaxed);
+        while (p > 1) {
+            if (pending.compare_exchange_weak(p, p - 1)) {
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.fetch_sub(1) == 1) {
+            cv.notify_all();
+        }
+    }
+
+    std::atomic<size_t> pending;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
 
 class ThreadPool {
 public:
     ThreadPool(size_t );
+    explicit ThreadPool(const ThreadPoolOptions& options);
     template <class F, class...Args>
     auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+    /* Like enqueue, but returns an invalid future instead of waiting when
+     * the ring or the max_queued bound is full. */
+    template <class F, class...Args>
+    auto try_enqueue(F&& f, Args&&... args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    /* Same, waiting up to timeout for room first. */
+    template <class Rep, class Period, class F, class...Args>
+    auto try_enqueue_for(std::chrono::duration<Rep, Period> timeout, F&& f, Args&&... args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    /* Run f on every element of [first, last) as separate tasks, queued
+     * with one lock and one wakeup.  The future holds the results in input
+     * order, or is future<void> when f returns nothing. */
+    template <class Iter, class F>
+    auto enqueue_bulk(Iter first, Iter last, F f)
+        -> std::future<typename BulkStateFor<Iter, F>::value_type>;
+    /* Fire and forget.  No future and, in steady state, no allocation:
+     * the callable is stored inline in a recycled task node.  f must not
+     * throw. */
+    template <class F>
+    void post(F&& f);
+    /* Same, and group.wait() returns once every task posted to it ran. */
+    template <class F>
+    void post(TaskGroup& group, F&& f);
+    /* post() to a worker on the given node (an index below nodes()). */
+    template <class F>
+    void post_on(int node, F&& f);
+    /* post() to a worker on the node holding buf, if that is known. */
+    template <class F>
+    void post_near(const void* buf, F&& f);
+    /* enqueue() and post() into a priority lane; std::invalid_argument
+     * unless lane < lanes(). */
+    template <class F, class...Args>
+    auto enqueue_lane(size_t lane, F&& f, Args&&... args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <class F>
+    void post_lane(size_t lane, F&& f);
+    /* Running workers; max_size() is the most an elastic pool may run. */
+    size_t size() const { return live; }
+    size_t max_size() const { return workers.size(); }
+    /* True on one of this pool's worker threads. */
+    bool is_worker() const { return self().pool == this; }
+    /* Node groups, 1 unless numa_aware. */
+    size_t nodes() const { return injectors.size(); }
+    /* Node index whose memory holds the page at p, or -1. */
+    int node_of(const void* p) const;
+    size_t lanes() const { return weights.size(); }
+    /* Snapshot of the counters; only queue depth without the metrics option. */
+    PoolMetrics metrics() const;
+    /* Scratch memory for the running task: the worker's own arena, reset
+     * after every task, so nothing allocated here may outlive the task.
+     * Other threads get a thread-local arena that is never reset for
+     * them; bracket its use with an ArenaScope. */
+    static BumpArena& scratch();
     ~ThreadPool();
 private:
+    typedef TaskNode Task;
+
+    template <class F>
+    Task* make_task(F&& f) {
+        Task* task = TaskNodePool::get();
+        try {
+            task->set(std::forward<F>(f));
+        } catch (...) {
+            TaskNodePool::put(task);
+            throw;
+        }
+        bool sampled = counters && ++self().tick % sample_every == 0;
+        if (elastic || sampled) {
+            /* the low bit tells execute() to clock it for metrics */
+            task->stamp = (now_ns() & ~uint64_t(1)) | (sampled ? 1 : 0);
+        }
+        return task;
+    }
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void execute(size_t index, Task* task);
+    static void run_task(Task* task) {
+        task->run();
+        TaskNodePool::put(task);
+    }
+    static void discard_task(Task* task) {
+        task->discard();
+        TaskNodePool::put(task);
+    }
+    static void discard_chain(Task* head) {
+        while (head) {
+            Task* next = head->next;
+            discard_task(head);
+            head = next;
+        }
+    }
+
+    /* Which pool and worker the calling thread belongs to, if any. */
+    struct WorkerSlot {
+        ThreadPool* pool = nullptr;
+        size_t index = 0;
+        uint64_t seed = 0;
+        unsigned tick = 0;      /* metrics sampling */
+        BumpArena* arena = nullptr;
+    };
+    static WorkerSlot& self() {
+        thread_local WorkerSlot slot;
+        return slot;
+    }
+
+    static constexpr unsigned SPIN_LIMIT = 64;
+    static constexpr unsigned YIELD_LIMIT = 16;
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    void start(size_t threads, size_t slots, bool pin = false, bool numa = false);
+    void supervise();
+    uint64_t oldest_wait();
+    void worker(size_t index);
+    /* Where a submission goes in the shared queue, -1 for the default.
+     * Either one set skips the worker's own deque. */
+    struct Route {
+        Route(int node = -1, int lane = -1) : node(node), lane(lane) {}
+        int node;
+        int lane;
+        bool explicit_queue() const { return node >= 0 || lane >= 0; }
+    };
+
+    bool offer(Task* task, Route route = Route());
+    void push(Task* task, Route route = Route());
+    bool push_until(Task* task, Route route, std::chrono::steady_clock::time_point deadline);
+    bool full() const;
+    size_t pick_injector(int node);
+    void push_bulk(Task* head, Task* tail, size_t n);
+    void push_each(Task* head);
+    void notify(size_t n = 1);
+    Task* pop(size_t index);
+    Task* steal(size_t index);
+
     std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
+    /* shared queue, an intrusive list through Task::next */
+    struct Lane {
+        Task* head = nullptr;
+        Task* tail = nullptr;
+        int64_t credit = 0;     /* weighted round robin state */
+    };
+    struct Injector {
+        std::vector<Lane> lanes;
+    };
+    void inject(Injector& q, size_t lane, Task* head, Task* tail);
+    void check_lane(size_t lane) const {
+        if (lane >= lanes()) {
+            throw std::invalid_argument("no such lane in threadPool");
+        }
+    }
+    Task* take(Injector& q);
+
+    std::vector<Injector> injectors;            /* one per node */
+    std::vector<int64_t> weights;               /* one per lane */
+    std::vector<int> node_ids;                  /* kernel id of each node */
+    std::vector<size_t> worker_node;
+    std::vector<std::vector<int>> worker_cpus;  /* empty: not pinned */
+    std::atomic<size_t> next_node;
+    std::vector<std::unique_ptr<WorkDeque<Task*>>> deques;
+    std::unique_ptr<MpmcRing<Task*>> ring;
 
     std::mutex queue_mutex;
     std::condition_variable condition;
-    bool stop;
+    /* outside submitters waiting for room under max_queued */
+    std::condition_variable space;
+    /* Tasks sitting in any queue, workers parked on condition, and
+     * submitters parked on space. */
+    std::atomic<size_t> queued;
+    /* The part of queued in the shared queue, injectors or ring: what
+     * max_queued bounds, and pop() skips the injector lock while it is 0. */
+    std::atomic<size_t> shared;
+    std::atomic<size_t> sleepers;
+    std::atomic<size_t> blocked;
+    size_t max_queued;
+    std::atomic<bool> stop;
+    bool stealing;
+
+    /* null unless options.metrics */
+    std::unique_ptr<WorkerCounters[]> counters;
+    unsigned sample_every;
+    std::atomic<uint64_t> full_events;
+
+    /* Elastic sizing.  workers has a slot per possible thread; active
+     * (under queue_mutex) says which are running. */
+    bool elastic;
+    size_t min_threads;
+    uint64_t grow_after_ns;
+    std::chrono::milliseconds retire_after;
+    std::vector<char> active;
+    std::atomic<size_t> live;
+    std::atomic<bool> grow_hint;
+    std::thread supervisor;
+    std::condition_variable supervisor_wake;
+
+    size_t arena_bytes;
 };
 
-inline ThreadPool::ThreadPool(size_t threads) : stop(false) {
+inline ThreadPool::ThreadPool(size_t threads)
+    : next_node(0), queued(0), shared(0), sleepers(0), blocked(0), max_queued(0),
+      stop(false), stealing(false), sample_every(1), full_events(0),
+      elastic(false), min_threads(threads), grow_after_ns(0), retire_after(0),
+      live(0), grow_hint(false), arena_bytes(ThreadPoolOptions().arena_bytes) {
+    start(threads, threads);
+}
+
+inline ThreadPool::ThreadPool(const ThreadPoolOptions& options)
+    : next_node(0), queued(0), shared(0), sleepers(0), blocked(0), max_queued(options.max_queued),
+      stop(false), stealing(options.work_stealing),
+      sample_every(options.metrics_sample ? options.metrics_sample : 1), full_events(0),
+      min_threads(options.threads ? options.threads : 1),
+      grow_after_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(options.grow_after).count()),
+      retire_after(options.retire_after), live(0), grow_hint(false),
+      arena_bytes(options.arena_bytes) {
+    if (options.ring_capacity && options.lane_weights.size() > 1) {
+        throw std::invalid_argument("a ring queue has a single lane");
+    }
+    size_t slots = std::max(min_threads, options.max_threads);
+    elastic = slots > min_threads;
+    if (options.metrics) {
+        counters.reset(new WorkerCounters[slots]);
+    }
+    if (options.ring_capacity) {
+        ring.reset(new MpmcRing<Task*>(options.ring_capacity));
+    }
+    for (unsigned w : options.lane_weights) {
+        weights.push_back(w ? w : 1);
+    }
+    start(min_threads, slots, options.pin_threads, options.numa_aware);
+}
+
+/* Place slots workers over the topology and run the first threads. */
+inline void ThreadPool::start(size_t threads, size_t slots, bool pin, bool numa) {
+    std::vector<NumaNode> topo;
+    if (pin || numa) {
+        topo = numa_nodes();
+    }
+    if (!numa) {
+        /* one group over every CPU */
+        NumaNode all{0, {}};
+        for (auto& n : topo) {
+            all.cpus.insert(all.cpus.end(), n.cpus.begin(), n.cpus.end());
+        }
+        topo.assign(1, all);
+    }
+    if (weights.empty()) {
+        weights.push_back(1);
+    }
+    injectors.resize(topo.size());
+    for (auto& q : injectors) {
+        q.lanes.resize(weights.size());
+    }
+    for (auto& n : topo) {
+        node_ids.push_back(n.id);
+    }
+    worker_node.resize(slots);
+    worker_cpus.resize(slots);
+    for (size_t i=0; i<slots; i++) {
+        size_t node = i * topo.size() / slots;
+        size_t first = (node * slots + topo.size() - 1) / topo.size();
+        const std::vector<int>& cpus = topo[node].cpus;
+        worker_node[i] = node;
+        if (pin && !cpus.empty()) {
+            worker_cpus[i].assign(1, cpus[(i - first) % cpus.size()]);
+        } else if (numa) {
+            worker_cpus[i] = cpus;
+        }
+    }
+
+    if (stealing) {
+        for (size_t i=0; i<slots; i++) {
+            deques.emplace_back(new WorkDeque<Task*>());
+        }
+    }
+    active.assign(slots, 0);
+    workers.resize(slots);
     for (size_t i=0; i<threads; i++) {
-        workers.emplace_back([this]{
-            for (;;) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this]{
-                        return this->stop||!this->tasks.empty();});
-                    if (this->stop && tasks.empty()) {
-                        return;
-                    }
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
+        active[i] = 1;
+        live++;
+        workers[i] = std::thread([this, i]{ this->worker(i); });
+    }
+    if (elastic) {
+        supervisor = std::thread([this]{ this->supervise(); });
+    }
+}
+
+/* Elastic pools only: every few milliseconds, add a worker if tasks are
+ * going stale in the queue while no worker is parked. */
+inline void ThreadPool::supervise() {
+    auto tick = std::chrono::nanoseconds(std::max<uint64_t>(grow_after_ns / 2, 1000000));
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (!stop) {
+        supervisor_wake.wait_for(lock, tick);
+        bool hint = grow_hint.exchange(false);
+        if (stop || live == workers.size() || sleepers > 0 || queued == 0) {
+            continue;
+        }
+        if (!hint && oldest_wait() <= grow_after_ns) {
+            continue;
+        }
+        size_t index = std::find(active.begin(), active.end(), 0) - active.begin();
+        active[index] = 1;
+        live++;
+        lock.unlock();
+        /* a retired worker in this slot has returned or is about to */
+        if (workers[index].joinable()) {
+            workers[index].join();
+        }
+        workers[index] = std::thread([this, index]{ this->worker(index); });
+        lock.lock();
+    }
+}
+
+/* Age of the oldest task at the head of a shared queue; queue_mutex held.
+ * Deques and the ring cannot be peeked, workers report those through
+ * grow_hint instead. */
+inline uint64_t ThreadPool::oldest_wait() {
+    uint64_t now = now_ns();
+    uint64_t oldest = 0;
+    for (auto& q : injectors) {
+        for (auto& l : q.lanes) {
+            if (l.head && l.head->stamp && now - l.head->stamp > oldest) {
+                oldest = now - l.head->stamp;
+            }
+        }
+    }
+    return oldest;
+}
+
+inline void ThreadPool::worker(size_t index) {
+#ifdef __linux__
+    if (!worker_cpus[index].empty()) {
+        pin_thread(pthread_self(), worker_cpus[index]);
+    }
+#endif
+    WorkerSlot& slot = self();
+    slot.pool = this;
+    slot.index = index;
+    slot.seed = 0x9e3779b97f4a7c15ULL * (index + 1);
+    /* its first block is allocated here, after pinning, on our node */
+    BumpArena arena(arena_bytes);
+    slot.arena = &arena;
+    unsigned idle = 0;
+    uint64_t idle_since = 0;
+    for (;;) {
+        Task* task = pop(index);
+        if (task) {
+            if (blocked > 0) {
+                { std::lock_guard<std::mutex> lock(queue_mutex); }
+                space.notify_one();
+            }
+            if (idle_since) {
+                WorkerCounters::bump(counters[index].idle_ns, now_ns() - idle_since);
+                idle_since = 0;
+            }
+            execute(index, task);
+            arena.reset();
+            idle = 0;
+            continue;
+        }
+        if (counters && !idle_since) {
+            idle_since = now_ns();
+        }
+        if (ring && idle < SPIN_LIMIT + YIELD_LIMIT) {
+            if (idle++ < SPIN_LIMIT) {
+                cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+        idle = 0;
+        std::unique_lock<std::mutex> lock(this->queue_mutex);
+        if (this->stop && this->queued == 0) {
+            return;
+        }
+        /* Pairs with the queued/sleepers check in push(): either we see
+         * the new task here or the pusher sees us and notifies. */
+        this->sleepers++;
+        auto ready = [this]{ return this->stop || this->queued > 0; };
+        if (!elastic) {
+            this->condition.wait(lock, ready);
+            this->sleepers--;
+            continue;
+        }
+        bool woke = this->condition.wait_for(lock, retire_after, ready);
+        this->sleepers--;
+        if (!woke && live > min_threads) {
+            /* Retire.  Safe against a racing push: it counted queued
+             * before we checked, or it sees the remaining workers. */
+            active[index] = 0;
+            live--;
+            return;
+        }
+    }
+}
+
+inline void ThreadPool::execute(size_t index, Task* task) {
+    if (elastic && task->stamp && !grow_hint.load(std::memory_order_relaxed) &&
+        now_ns() - task->stamp > grow_after_ns) {
+        grow_hint.store(true, std::memory_order_relaxed);
+    }
+    if (!counters) {
+        run_task(task);
+        return;
+    }
+    WorkerCounters& c = counters[index];
+    uint64_t stamp = task->stamp;
+    if (stamp & 1) {
+        uint64_t start = now_ns();
+        run_task(task);
+        uint64_t end = now_ns();
+        WorkerCounters::bump(c.wait_ns[Log2Histogram::bucket(start - stamp)]);
+        WorkerCounters::bump(c.run_ns[Log2Histogram::bucket(end - start)]);
+    } else {
+        run_task(task);
+    }
+    WorkerCounters::bump(c.executed);
+}
+
+inline BumpArena& ThreadPool::scratch() {
+    WorkerSlot& slot = self();
+    if (slot.arena) {
+        return *slot.arena;
+    }
+    thread_local BumpArena own;
+    return own;
+}
+
+inline PoolMetrics ThreadPool::metrics() const {
+    PoolMetrics m;
+    m.threads = live;
+    m.queued = queued;
+    m.sleeping = sleepers;
+    m.full_events = full_events;
+    if (counters) {
+        for (size_t i=0; i<workers.size(); i++) {
+            m.workers.push_back(counters[i].snapshot());
+            m.total.merge(m.workers.back());
+        }
+    }
+    return m;
+}
+
+/* Queue a task where route says; false when the ring or the max_queued
+ * bound is full.  The ring has a single lane and ignores the route.  A
+ * worker's own deque is never bounded. */
+inline bool ThreadPool::offer(Task* task, Route route) {
+    WorkerSlot& slot = self();
+    if (!route.explicit_queue() && stealing && slot.pool == this) {
+        /* count first so a thief cannot take the task before it is counted */
+        queued++;
+        deques[slot.index]->push(task);
+    } else if (ring) {
+        if (stop) {
+            discard_task(task);
+            throw std::runtime_error("enqueue on stopped threadPool");
+        }
+        if (max_queued && shared >= max_queued) {
+            full_events++;
+            return false;
+        }
+        /* count first so a worker cannot see the task but queued == 0 */
+        queued++;
+        shared++;
+        if (!ring->try_push(task)) {
+            shared--;
+            queued--;
+            full_events++;
+            return false;
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (stop){
+            discard_task(task);
+            throw std::runtime_error("enqueue on stopped threadPool");
+        }
+        if (max_queued && shared >= max_queued) {
+            full_events++;
+            return false;
+        }
+        inject(injectors[pick_injector(route.node)], route.lane < 0 ? 0 : route.lane, task, task);
+        queued++;
+        shared++;
+    }
+    notify();
+    return true;
+}
+
+inline void ThreadPool::push(Task* task, Route route) {
+    push_until(task, route, std::chrono::steady_clock::time_point::max());
+}
+
+/* When the pool is full an outside submitter waits for room, until the
+ * deadline at most; false means it is still full and the task was not
+ * queued.  A worker runs the task itself instead, since waiting could
+ * deadlock the pool. */
+inline bool ThreadPool::push_until(Task* task, Route route,
+                                   std::chrono::steady_clock::time_point deadline) {
+    if (offer(task, route)) {
+        return true;
+    }
+    if (self().pool == this) {
+        if (counters) {
+            WorkerCounters::bump(counters[self().index].inline_runs);
+        }
+        run_task(task);
+        return true;
+    }
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            /* pairs with the blocked check after a worker's pop */
+            blocked++;
+            auto room = [this]{ return stop || !full(); };
+            bool ok = true;
+            if (deadline == std::chrono::steady_clock::time_point::max()) {
+                space.wait(lock, room);
+            } else {
+                ok = space.wait_until(lock, deadline, room);
+            }
+            blocked--;
+            if (!ok) {
+                return false;
+            }
+        }
+        if (offer(task, route)) {
+            return true;
+        }
+    }
+}
+
+inline bool ThreadPool::full() const {
+    size_t n = shared;
+    return (max_queued && n >= max_queued) || (ring && n >= ring->capacity());
+}
+
+/* The node's queue, else the calling worker's own, else round robin. */
+inline size_t ThreadPool::pick_injector(int node) {
+    if (node >= 0) {
+        return static_cast<size_t>(node) % injectors.size();
+    }
+    WorkerSlot& slot = self();
+    if (slot.pool == this) {
+        return worker_node[slot.index];
+    }
+    return injectors.size() == 1 ? 0 : next_node++ % injectors.size();
+}
+
+inline int ThreadPool::node_of(const void* p) const {
+    if (injectors.size() == 1) {
+        return 0;
+    }
+    int id = numa_node_of(p);
+    for (size_t i=0; i<node_ids.size(); i++) {
+        if (node_ids[i] == id) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/* Queue a chain of n tasks linked through next, paying for the lock and
+ * the wakeup once. */
+inline void ThreadPool::push_bulk(Task* head, Task* tail, size_t n) {
+    WorkerSlot& slot = self();
+    if (stealing && slot.pool == this) {
+        queued += n;
+        while (head) {
+            Task* next = head->next;
+            deques[slot.index]->push(head);
+            head = next;
+        }
+    } else if (ring) {
+        if (stop) {
+            discard_chain(head);
+            throw std::runtime_error("enqueue on stopped threadPool");
+        }
+        /* a ring has no lock to amortise: take what room there is, as
+         * offer() would, and let push() wait for the rest */
+        size_t room = n;
+        if (max_queued) {
+            size_t q = shared;
+            room = q < max_queued ? std::min(n, max_queued - q) : 0;
+        }
+        size_t pushed = 0;
+        queued += room;
+        shared += room;
+        while (head && pushed < room) {
+            Task* next = head->next;
+            if (!ring->try_push(head)) {
+                break;
+            }
+            head = next;
+            pushed++;
+        }
+        shared -= room - pushed;
+        queued -= room - pushed;
+        if (head) {
+            full_events++;
+        }
+        notify(pushed);
+        push_each(head);
+        return;
+    } else if (max_queued && shared + n > max_queued) {
+        /* would overshoot the bound, queue one at a time */
+        push_each(head);
+        return;
+    } else {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (stop){
+            lock.unlock();
+            discard_chain(head);
+            throw std::runtime_error("enqueue on stopped threadPool");
+        }
+        inject(injectors[pick_injector(-1)], 0, head, tail);
+        queued += n;
+        shared += n;
+    }
+    notify(n);
+}
+
+/* push() the tasks of a chain one by one, waiting for room as needed.
+ * If the pool stops meanwhile the rest of the chain is discarded. */
+inline void ThreadPool::push_each(Task* head) {
+    while (head) {
+        Task* next = head->next;
+        head->next = nullptr;
+        try {
+            push(head);
+        } catch (...) {
+            discard_chain(next);
+            throw;
+        }
+        head = next;
+    }
+}
+
+/* Wake up to n parked workers.  Taking the mutex orders us after a worker
+ * that is between its queued check and the wait. */
+inline void ThreadPool::notify(size_t n) {
+    size_t parked = sleepers;
+    if (parked == 0 || n == 0) {
+        return;
+    }
+    { std::lock_guard<std::mutex> lock(queue_mutex); }
+    if (n >= parked) {
+        condition.notify_all();
+    } else {
+        while (n--) {
+            condition.notify_one();
+        }
+    }
+}
+
+inline ThreadPool::Task* ThreadPool::pop(size_t index) {
+    Task* task = nullptr;
+    if (stealing && deques[index]->pop(task)) {
+        queued--;
+        return task;
+    }
+    if (ring) {
+        if (ring->try_pop(task)) {
+            shared--;
+            queued--;
+            return task;
+        }
+    } else if (shared > 0) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        /* own node first */
+        size_t home = worker_node[index];
+        for (size_t k=0; k<injectors.size(); k++) {
+            task = take(injectors[(home + k) % injectors.size()]);
+            if (task) {
+                shared--;
+                queued--;
+                return task;
+            }
+        }
+    }
+    return stealing ? steal(index) : nullptr;
+}
+
+/* Append a chain to a lane; queue_mutex held. */
+inline void ThreadPool::inject(Injector& q, size_t lane, Task* head, Task* tail) {
+    Lane& l = q.lanes[lane];
+    if (l.tail) {
+        l.tail->next = head;
+    } else {
+        l.head = head;
+    }
+    l.tail = tail;
+}
+
+/* Pop from the lane that smooth weighted round robin picks among the
+ * non-empty ones: each gains its weight, the richest is served and pays
+ * the total.  queue_mutex held. */
+inline ThreadPool::Task* ThreadPool::take(Injector& q) {
+    Lane* best = nullptr;
+    if (q.lanes.size() == 1) {
+        best = q.lanes[0].head ? &q.lanes[0] : nullptr;
+    } else {
+        int64_t total = 0;
+        for (size_t i=0; i<q.lanes.size(); i++) {
+            Lane& l = q.lanes[i];
+            if (!l.head) {
+                continue;
+            }
+            l.credit += weights[i];
+            total += weights[i];
+            if (!best || l.credit > best->credit) {
+                best = &l;
+            }
+        }
+        if (best) {
+            best->credit -= total;
+        }
+    }
+    if (!best) {
+        return nullptr;
+    }
+    Task* task = best->head;
+    best->head = task->next;
+    if (!best->head) {
+        best->tail = nullptr;
+        best->credit = 0;
+    }
+    task->next = nullptr;
+    return task;
+}
+
+inline ThreadPool::Task* ThreadPool::steal(size_t index) {
+    WorkerSlot& slot = self();
+    size_t n = deques.size();
+    /* xorshift64 for a random first victim */
+    slot.seed ^= slot.seed << 13;
+    slot.seed ^= slot.seed >> 7;
+    slot.seed ^= slot.seed << 17;
+    size_t start = slot.seed % n;
+    Task* task = nullptr;
+    /* peers on our node first, then the rest */
+    for (int near = 1; near >= 0; near--) {
+        for (size_t k=0; k<n; k++) {
+            size_t victim = (start + k) % n;
+            if (victim == index || (worker_node[victim] == worker_node[index]) != (near == 1)) {
+                continue;
+            }
+            if (deques[victim]->steal(task)) {
+                if (counters) {
+                    WorkerCounters::bump(counters[index].steals);
                 }
-                task();
+                queued--;
+                return task;
             }
-        });
+        }
     }
+    return nullptr;
 }
 
 template <class F, class... Args>
@@ -53,28 +964,147 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
     auto task = std::make_shared<std::packaged_task<return_type()>> (
-        std::bind(std::forward<F>(f), std::forward<args>(args)...)
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
     );
     std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        if (stop){
-            throw std::runtime_error("enqueue on stopped threadPool");
+    push(make_task([task](){(*task)();}));
+    return res;
+}
+
+template <class F, class... Args>
+auto ThreadPool::try_enqueue(F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+    using return_type = typename std::result_of<F(Args...)>::type;
+    auto task = std::make_shared<std::packaged_task<return_type()>> (
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+    );
+    /* before offer(), after which a worker may already be running it */
+    std::future<return_type> res = task->get_future();
+    Task* node = make_task([task](){(*task)();});
+    if (!offer(node)) {
+        discard_task(node);
+        return std::future<return_type>();
+    }
+    return res;
+}
+
+template <class Iter, class F>
+auto ThreadPool::enqueue_bulk(Iter first, Iter last, F f)
+    -> std::future<typename BulkStateFor<Iter, F>::value_type> {
+    typedef typename std::iterator_traits<Iter>::value_type item_type;
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    auto state = std::make_shared<BulkStateFor<Iter, F>>(n, std::move(f));
+    auto res = state->done.get_future();
+    if (n == 0) {
+        state->remaining = 1;
+        state->finish();
+        return res;
+    }
+    Task* head = nullptr;
+    Task* tail = nullptr;
+    size_t i = 0;
+    try {
+        for (; first != last; ++first, ++i) {
+            Task* task = make_task([state, i, item = item_type(*first)]() mutable {
+                state->run(i, item);
+            });
+            if (tail) {
+                tail->next = task;
+            } else {
+                head = task;
+            }
+            tail = task;
         }
-        tasks.emplace([task](){(*task)();});
+    } catch (...) {
+        discard_chain(head);
+        throw;
+    }
+    push_bulk(head, tail, n);
+    return res;
+}
+
+template <class Rep, class Period, class F, class... Args>
+auto ThreadPool::try_enqueue_for(std::chrono::duration<Rep, Period> timeout, F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+    using return_type = typename std::result_of<F(Args...)>::type;
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+    auto task = std::make_shared<std::packaged_task<return_type()>> (
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+    );
+    std::future<return_type> res = task->get_future();
+    Task* node = make_task([task](){(*task)();});
+    if (!push_until(node, Route(), deadline)) {
+        discard_task(node);
+        return std::future<return_type>();
     }
-    condition.notify_one();
     return res;
 }
 
+template <class F>
+void ThreadPool::post(F&& f) {
+    push(make_task(std::forward<F>(f)));
+}
+
+template <class F>
+void ThreadPool::post_on(int node, F&& f) {
+    push(make_task(std::forward<F>(f)), Route{node < 0 ? 0 : node, -1});
+}
+
+template <class F>
+void ThreadPool::post_near(const void* buf, F&& f) {
+    push(make_task(std::forward<F>(f)), Route{node_of(buf), -1});
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_lane(size_t lane, F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+    using return_type = typename std::result_of<F(Args...)>::type;
+    check_lane(lane);
+    auto task = std::make_shared<std::packaged_task<return_type()>> (
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+    );
+    std::future<return_type> res = task->get_future();
+    push(make_task([task](){(*task)();}), Route{-1, static_cast<int>(lane)});
+    return res;
+}
+
+template <class F>
+void ThreadPool::post_lane(size_t lane, F&& f) {
+    check_lane(lane);
+    push(make_task(std::forward<F>(f)), Route{-1, static_cast<int>(lane)});
+}
+
+template <class F>
+void ThreadPool::post(TaskGroup& group, F&& f) {
+    group.add();
+    try {
+        push(make_task([&group, fn = typename std::decay<F>::type(std::forward<F>(f))]() mutable {
+            fn();
+            group.done();
+        }));
+    } catch (...) {
+        group.done();
+        throw;
+    }
+}
+
 inline ThreadPool::~ThreadPool() {
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
         stop = true;
     }
     condition.notify_all();
+    space.notify_all();
+    supervisor_wake.notify_all();
+    /* first, so no worker is started behind our back */
+    if (supervisor.joinable()) {
+        supervisor.join();
+    }
     for (std::thread & worker: workers) {
-        worker.join();
+        if (worker.joinable()) {
+            worker.join();
+        }
     }
 }
 
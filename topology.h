@@ -0,0 +1,154 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * CPU and NUMA topology, read from /sys without libnuma.
+ *
+ * Nodes are listed in sysfs order with only the CPUs this process may run
+ * on; memory-only nodes are dropped.  Without sysfs (or off Linux) there
+ * is a single node holding every allowed CPU.
+ */
+struct NumaNode {
+    int id;                 /* kernel node number */
+    std::vector<int> cpus;
+};
+
+/* "0-3,8,10-11" -> {0,1,2,3,8,10,11} */
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        char* end;
+        long lo = strtol(list.c_str() + pos, &end, 10);
+        if (end == list.c_str() + pos) {
+            break;
+        }
+        long hi = lo;
+        pos = end - list.c_str();
+        if (pos < list.size() && list[pos] == '-') {
+            hi = strtol(list.c_str() + pos + 1, &end, 10);
+            pos = end - list.c_str();
+        }
+        for (long c = lo; c <= hi; c++) {
+            cpus.push_back(static_cast<int>(c));
+        }
+        if (pos < list.size() && list[pos] == ',') {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    return cpus;
+}
+
+#ifdef __linux__
+
+inline std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set)) {
+                cpus.push_back(c);
+            }
+        }
+    }
+    return cpus;
+}
+
+inline std::vector<NumaNode> numa_nodes() {
+    std::vector<int> allowed = allowed_cpus();
+    std::vector<NumaNode> nodes;
+
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir) {
+        while (struct dirent* ent = readdir(dir)) {
+            int id;
+            char tail;
+            if (sscanf(ent->d_name, "node%d%c", &id, &tail) != 1) {
+                continue;
+            }
+            std::string path = "/sys/devices/system/node/" + std::string(ent->d_name) + "/cpulist";
+            FILE* f = fopen(path.c_str(), "r");
+            if (!f) {
+                continue;
+            }
+            char buf[4096];
+            std::string list = fgets(buf, sizeof(buf), f) ? buf : "";
+            fclose(f);
+
+            NumaNode node{id, {}};
+            for (int c : parse_cpu_list(list)) {
+                if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) {
+                    node.cpus.push_back(c);
+                }
+            }
+            if (!node.cpus.empty()) {
+                nodes.push_back(node);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end(),
+              [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+
+    if (nodes.empty()) {
+        nodes.push_back(NumaNode{0, allowed});
+    }
+    return nodes;
+}
+
+/* Kernel node holding the page at addr, or -1.  The page must have been
+ * touched, otherwise there is nothing placed yet to ask about. */
+inline int numa_node_of(const void* addr) {
+#ifdef SYS_get_mempolicy
+    const unsigned long MPOL_F_NODE_ = 1, MPOL_F_ADDR_ = 2;
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0UL, addr, MPOL_F_NODE_ | MPOL_F_ADDR_) == 0) {
+        return node;
+    }
+#else
+    (void)addr;
+#endif
+    return -1;
+}
+
+/* Restrict a thread to the given CPUs; false if the kernel refused. */
+inline bool pin_thread(pthread_t thread, const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) {
+        CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+#else
+
+inline std::vector<NumaNode> numa_nodes() {
+    NumaNode node{0, {}};
+    return std::vector<NumaNode>{node};
+}
+
+inline int numa_node_of(const void*) {
+    return -1;
+}
+
+#endif
+
+#endif
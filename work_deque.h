@@ -0,0 +1,126 @@
+#ifndef WORK_DEQUE_H
+#define WORK_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli 2013).
+ *
+ * The owning worker pushes and pops at the bottom without taking a lock;
+ * any other thread steals from the top with one CAS.  The buffer grows
+ * when full; outgrown buffers are kept until destruction because a
+ * concurrent thief may still be reading from one.  T must be trivially
+ * copyable, the pool stores task pointers.
+ */
+template <class T>
+class WorkDeque {
+public:
+    explicit WorkDeque(size_t capacity = 256)
+        : top(0), bottom(0), array(new Array(round_up(capacity))) {}
+
+    ~WorkDeque() {
+        delete array.load(std::memory_order_relaxed);
+        for (Array* a : retired) {
+            delete a;
+        }
+    }
+
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    /* owner only */
+    void push(T x) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(a->capacity) - 1) {
+            a = grow(a, t, b);
+        }
+        a->put(b, x);
+        /* a release store rather than the paper's fence, which race
+         * detectors cannot see; same code on x86 */
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    /* owner only, newest first */
+    bool pop(T& x) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        x = a->get(b);
+        if (t == b) {
+            /* last element, race the thieves for it */
+            bool won = top.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /* any thread, oldest first; false if empty or lost a race */
+    bool steal(T& x) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        Array* a = array.load(std::memory_order_acquire);
+        x = a->get(t);
+        return top.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array {
+        explicit Array(size_t capacity)
+            : capacity(capacity), mask(capacity - 1), slots(new std::atomic<T>[capacity]) {}
+        ~Array() { delete[] slots; }
+
+        void put(int64_t i, T x) { slots[i & mask].store(x, std::memory_order_relaxed); }
+        T get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+
+        size_t capacity;    /* power of two */
+        size_t mask;
+        std::atomic<T>* slots;
+    };
+
+    static size_t round_up(size_t n) {
+        size_t c = 2;
+        while (c < n) {
+            c <<= 1;
+        }
+        return c;
+    }
+
+    Array* grow(Array* a, int64_t t, int64_t b) {
+        Array* bigger = new Array(a->capacity * 2);
+        for (int64_t i = t; i < b; i++) {
+            bigger->put(i, a->get(i));
+        }
+        retired.push_back(a);
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+    std::atomic<Array*> array;
+    std::vector<Array*> retired;
+};
+
+#endif